@@ -0,0 +1,170 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BinningKernel.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+/**
+
+    Checks that the scalar, SSE4.1 and AVX2 binning kernels agree,
+    then times each of them on runs of the size used by
+    PSTHAccumulator::addTrial.
+
+*/
+
+struct Configuration
+{
+    const char* name;
+    double sampleRate;
+    int binsPerMs;
+    int preMs;
+    int postMs;
+};
+
+static const int runLength = 1024;
+static const int numRuns = 256;
+static const int numRepeats = 200;
+
+static std::vector<int64> makeSpikes(const Configuration& config, int64 eventSampleNumber, std::mt19937_64& random)
+{
+    // spikes spread a little beyond the window on both sides, so some are
+    // out of range, and some land exactly on bin edges
+    const int64 preSamples = int64(config.preMs * config.sampleRate / 1000);
+    const int64 postSamples = int64(config.postMs * config.sampleRate / 1000);
+    const int64 span = preSamples + postSamples + 2000;
+
+    std::vector<int64> spikes(runLength * numRuns);
+
+    for (size_t i = 0; i < spikes.size(); i++)
+    {
+        if (i % 16 == 0)
+            spikes[i] = eventSampleNumber + int64(std::round((int64(random() % 200) - 100) * config.sampleRate / (1000.0 * config.binsPerMs)));
+        else
+            spikes[i] = eventSampleNumber - preSamples - 1000 + int64(random() % span);
+    }
+
+    return spikes;
+}
+
+static double timeKernel(BinningKernel::KernelFunction kernel, const std::vector<int64>& spikes, int64 eventSampleNumber,
+                         double binsPerSample, int binOffset, int numBins, std::vector<int>& binIndices)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int repeat = 0; repeat < numRepeats; repeat++)
+    {
+        for (int run = 0; run < numRuns; run++)
+            kernel(spikes.data() + run * runLength, runLength, eventSampleNumber,
+                   binsPerSample, binOffset, numBins, binIndices.data() + run * runLength);
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return seconds * 1e9 / (double(numRepeats) * numRuns * runLength);
+}
+
+int main()
+{
+    const Configuration configurations[] = {
+        { "30 kHz, 1 ms base, +/-500 ms", 30000.0, 1, 500, 500 },
+        { "30 kHz, 0.1 ms base, +/-500 ms", 30000.0, 10, 500, 500 },
+        { "40 kHz, 1 ms base, +/-10 s", 40000.0, 1, 10000, 10000 },
+        { "30000.5 Hz, 0.1 ms base, 200/800 ms", 30000.5, 10, 200, 800 }
+    };
+
+    const char* names[] = { "scalar", "SSE4.1", "AVX2" };
+
+    const BinningKernel::Implementation implementations[] = {
+        BinningKernel::SCALAR, BinningKernel::SSE41, BinningKernel::AVX2
+    };
+
+    std::mt19937_64 random(1);
+
+    int numMismatches = 0;
+
+    for (const auto& config : configurations)
+    {
+        const int64 eventSampleNumber = 123456789;
+        const double binsPerSample = config.binsPerMs * 1000.0 / config.sampleRate;
+        const int binOffset = config.preMs * config.binsPerMs;
+        const int numBins = (config.preMs + config.postMs) * config.binsPerMs;
+
+        const std::vector<int64> spikes = makeSpikes(config, eventSampleNumber, random);
+
+        std::vector<int> reference(spikes.size());
+        std::vector<int> binIndices(spikes.size());
+
+        BinningKernel::computeBinIndicesScalar(spikes.data(), (int) spikes.size(), eventSampleNumber,
+                                               binsPerSample, binOffset, numBins, reference.data());
+
+        std::printf("%s\n", config.name);
+
+        double scalarTime = 0.0;
+
+        for (int i = 0; i < 3; i++)
+        {
+            const BinningKernel::KernelFunction kernel = BinningKernel::getImplementation(implementations[i]);
+
+            if (kernel == nullptr)
+            {
+                std::printf("  %-7s not supported\n", names[i]);
+                continue;
+            }
+
+            // odd lengths exercise the scalar remainder of the vector paths
+            kernel(spikes.data(), (int) spikes.size() - 7, eventSampleNumber,
+                   binsPerSample, binOffset, numBins, binIndices.data());
+
+            int mismatches = 0;
+
+            for (size_t j = 0; j < spikes.size() - 7; j++)
+            {
+                if (binIndices[j] != reference[j])
+                    mismatches++;
+            }
+
+            numMismatches += mismatches;
+
+            const double time = timeKernel(kernel, spikes, eventSampleNumber, binsPerSample, binOffset, numBins, binIndices);
+
+            if (i == 0)
+                scalarTime = time;
+
+            std::printf("  %-7s %6.3f ns/spike  %5.1fx  %d mismatches\n",
+                        names[i], time, scalarTime / time, mismatches);
+        }
+    }
+
+    if (numMismatches > 0)
+    {
+        std::printf("FAILED: the implementations disagree\n");
+        return 1;
+    }
+
+    std::printf("All implementations agree\n");
+
+    return 0;
+}
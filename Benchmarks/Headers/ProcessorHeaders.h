@@ -0,0 +1,41 @@
+/*
+    Minimal stand-in for the plugin API header, providing only what
+    BinningKernel needs, so the benchmark builds without the GUI.
+*/
+
+#ifndef BENCHMARK_PROCESSORHEADERS_H_
+#define BENCHMARK_PROCESSORHEADERS_H_
+
+#include <cstdint>
+
+typedef int64_t int64;
+typedef int32_t int32;
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+ #define JUCE_INTEL 1
+#endif
+
+#if defined(__clang__)
+ #define JUCE_CLANG 1
+#elif defined(__GNUC__)
+ #define JUCE_GCC 1
+#elif defined(_MSC_VER)
+ #define JUCE_MSVC 1
+ #include <intrin.h>
+#endif
+
+struct SystemStats
+{
+#if JUCE_GCC || JUCE_CLANG
+    static bool hasAVX2() { return __builtin_cpu_supports("avx2"); }
+    static bool hasSSE41() { return __builtin_cpu_supports("sse4.1"); }
+#elif JUCE_MSVC
+    static bool hasAVX2() { int info[4]; __cpuidex(info, 7, 0); return (info[1] & (1 << 5)) != 0; }
+    static bool hasSSE41() { int info[4]; __cpuid(info, 1); return (info[2] & (1 << 19)) != 0; }
+#else
+    static bool hasAVX2() { return false; }
+    static bool hasSSE41() { return false; }
+#endif
+};
+
+#endif  // BENCHMARK_PROCESSORHEADERS_H_
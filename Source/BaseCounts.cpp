@@ -0,0 +1,86 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BaseCounts.h"
+
+BaseCounts::BaseCounts(int numBins_)
+    : narrow(numBins_, 0),
+      numBins(numBins_)
+{
+
+}
+
+void BaseCounts::setNumBins(int numBins_)
+{
+    numBins = numBins_;
+
+    narrow.assign(numBins, 0);
+    std::vector<uint32>().swap(wide);
+}
+
+void BaseCounts::clear()
+{
+    setNumBins(size());
+}
+
+void BaseCounts::extend(int binsBefore, int binsAfter)
+{
+    if (wide.empty())
+    {
+        narrow.insert(narrow.begin(), binsBefore, 0);
+        narrow.insert(narrow.end(), binsAfter, 0);
+    }
+    else
+    {
+        wide.insert(wide.begin(), binsBefore, 0);
+        wide.insert(wide.end(), binsAfter, 0);
+    }
+
+    numBins += binsBefore + binsAfter;
+}
+
+void BaseCounts::sumInto(const int* binMap, int* counts) const
+{
+    if (wide.empty())
+    {
+        for (int i = 0; i < numBins; i++)
+        {
+            if (binMap[i] >= 0)
+                counts[binMap[i]] += narrow[i];
+        }
+    }
+    else
+    {
+        for (int i = 0; i < numBins; i++)
+        {
+            if (binMap[i] >= 0)
+                counts[binMap[i]] += int(wide[i]);
+        }
+    }
+}
+
+void BaseCounts::widen()
+{
+    wide.assign(narrow.begin(), narrow.end());
+
+    std::vector<uint16>().swap(narrow);
+}
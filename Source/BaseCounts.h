@@ -0,0 +1,103 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef BASECOUNTS_H_
+#define BASECOUNTS_H_
+
+#include <ProcessorHeaders.h>
+
+#include <vector>
+
+/**
+
+    Spike counts for one unit at the finest binning resolution.
+
+    Counts are stored as 16-bit values, and the whole row is widened
+    to 32 bits the first time any count would overflow, so the common
+    case needs half the memory without ever saturating.
+
+*/
+class BaseCounts
+{
+public:
+
+    /** Constructor */
+    BaseCounts(int numBins = 0);
+
+    /** Sets the number of bins and clears all counts */
+    void setNumBins(int numBins);
+
+    /** Clears all counts */
+    void clear();
+
+    /** Adds empty bins before the first and after the last bin */
+    void extend(int binsBefore, int binsAfter);
+
+    /** Returns the number of bins */
+    int size() const { return numBins; }
+
+    /** Adds one spike to a bin */
+    void increment(int bin)
+    {
+        if (wide.empty())
+        {
+            if (narrow[bin] < 0xFFFF)
+            {
+                narrow[bin]++;
+                return;
+            }
+
+            widen();
+        }
+
+        wide[bin]++;
+    }
+
+    /** Removes one spike from a bin */
+    void decrement(int bin)
+    {
+        if (wide.empty())
+            narrow[bin]--;
+        else
+            wide[bin]--;
+    }
+
+    /** Returns the count in one bin */
+    int get(int bin) const { return wide.empty() ? int(narrow[bin]) : int(wide[bin]); }
+
+    /** Adds each count to counts[binMap[i]], skipping bins mapped to -1 */
+    void sumInto(const int* binMap, int* counts) const;
+
+private:
+
+    /** Switches to 32-bit storage */
+    void widen();
+
+    std::vector<uint16> narrow;
+    std::vector<uint32> wide;
+
+    int numBins;
+};
+
+
+#endif  // BASECOUNTS_H_
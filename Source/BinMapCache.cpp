@@ -0,0 +1,62 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BinMapCache.h"
+
+BinMapCache::BinMap BinMapCache::getMap(int numBaseBins, int basePreBins, int preBins, int postBins, int binSize)
+{
+    const Layout layout(numBaseBins, basePreBins, preBins, postBins, binSize);
+
+    // drop the maps that are no longer used by any accumulator
+    for (auto it = maps.begin(); it != maps.end();)
+    {
+        if (it->second.expired())
+            it = maps.erase(it);
+        else
+            ++it;
+    }
+
+    auto existing = maps.find(layout);
+
+    if (existing != maps.end())
+        return existing->second.lock();
+
+    const int nBins = (preBins + postBins + binSize - 1) / binSize;
+
+    std::shared_ptr<Array<int>> map = std::make_shared<Array<int>>();
+
+    map->ensureStorageAllocated(numBaseBins);
+
+    for (int i = 0; i < numBaseBins; i++)
+    {
+        const int offset = i - basePreBins;
+
+        if (offset < -preBins || offset >= postBins)
+            map->add(-1);
+        else
+            map->add(jmin((offset + preBins) / binSize, nBins - 1));
+    }
+
+    maps[layout] = map;
+
+    return map;
+}
@@ -0,0 +1,71 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef BINMAPCACHE_H_
+#define BINMAPCACHE_H_
+
+#include <ProcessorHeaders.h>
+
+#include <map>
+#include <memory>
+#include <tuple>
+
+/**
+
+    Maps from base bins to display bins, shared by all accumulators
+    with the same base range, window and bin size.
+
+    Every accumulator of an engine normally has the same layout, so
+    each map is stored once rather than once per accumulator. A map
+    is freed when the last accumulator using it lets go of it.
+
+*/
+class BinMapCache
+{
+public:
+
+    /** Bin for each base bin, or -1 if it is outside the window */
+    typedef std::shared_ptr<const Array<int>> BinMap;
+
+    /** Constructor */
+    BinMapCache() { }
+
+    /** Destructor */
+    ~BinMapCache() { }
+
+    /** Returns the map for numBaseBins base bins starting basePreBins before the event,
+        into bins of binSize base bins covering [-preBins, postBins); all bins have
+        the same width except for the last one, which ends at postBins */
+    BinMap getMap(int numBaseBins, int basePreBins, int preBins, int postBins, int binSize);
+
+private:
+
+    typedef std::tuple<int, int, int, int, int> Layout;
+
+    std::map<Layout, std::weak_ptr<const Array<int>>> maps;
+
+    JUCE_DECLARE_NON_COPYABLE(BinMapCache);
+};
+
+
+#endif  // BINMAPCACHE_H_
@@ -0,0 +1,174 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BinningKernel.h"
+
+#include <cmath>
+
+#if JUCE_INTEL
+ #include <immintrin.h>
+
+ #if JUCE_GCC || JUCE_CLANG
+  #define PSTH_TARGET(isa) __attribute__((target(isa)))
+ #else
+  #define PSTH_TARGET(isa)
+ #endif
+#endif
+
+// Offsets are converted through int32, which is exact as long as a
+// spike lies within about 12 hours of its event at 50 kHz.
+
+void BinningKernel::computeBinIndicesScalar(const int64* sampleNumbers,
+                                            int numSpikes,
+                                            int64 eventSampleNumber,
+                                            double binsPerSample,
+                                            int binOffset,
+                                            int numBins,
+                                            int* binIndices)
+{
+    for (int i = 0; i < numSpikes; i++)
+    {
+        const double x = double(int32(sampleNumbers[i] - eventSampleNumber)) * binsPerSample;
+        const int bin = int(std::floor(x)) + binOffset;
+
+        binIndices[i] = (bin >= 0 && bin < numBins) ? bin : -1;
+    }
+}
+
+#if JUCE_INTEL
+
+PSTH_TARGET("sse4.1")
+static void computeBinIndicesSSE41(const int64* sampleNumbers,
+                                   int numSpikes,
+                                   int64 eventSampleNumber,
+                                   double binsPerSample,
+                                   int binOffset,
+                                   int numBins,
+                                   int* binIndices)
+{
+    const __m128i event = _mm_set1_epi64x(eventSampleNumber);
+    const __m128d scale = _mm_set1_pd(binsPerSample);
+    const __m128i offset = _mm_set1_epi32(binOffset);
+    const __m128i invalid = _mm_set1_epi32(-1);
+    const __m128i upper = _mm_set1_epi32(numBins);
+
+    int i = 0;
+
+    for (; i + 2 <= numSpikes; i += 2)
+    {
+        const __m128i samples = _mm_loadu_si128((const __m128i*) (sampleNumbers + i));
+        const __m128i delta = _mm_shuffle_epi32(_mm_sub_epi64(samples, event), _MM_SHUFFLE(2, 0, 2, 0));
+
+        const __m128d x = _mm_floor_pd(_mm_mul_pd(_mm_cvtepi32_pd(delta), scale));
+        const __m128i bins = _mm_add_epi32(_mm_cvttpd_epi32(x), offset);
+
+        const __m128i valid = _mm_and_si128(_mm_cmpgt_epi32(bins, invalid),
+                                            _mm_cmplt_epi32(bins, upper));
+
+        _mm_storel_epi64((__m128i*) (binIndices + i), _mm_blendv_epi8(invalid, bins, valid));
+    }
+
+    BinningKernel::computeBinIndicesScalar(sampleNumbers + i, numSpikes - i, eventSampleNumber,
+                                           binsPerSample, binOffset, numBins, binIndices + i);
+}
+
+PSTH_TARGET("avx2")
+static void computeBinIndicesAVX2(const int64* sampleNumbers,
+                                  int numSpikes,
+                                  int64 eventSampleNumber,
+                                  double binsPerSample,
+                                  int binOffset,
+                                  int numBins,
+                                  int* binIndices)
+{
+    const __m256i event = _mm256_set1_epi64x(eventSampleNumber);
+    const __m256i lowHalves = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    const __m256d scale = _mm256_set1_pd(binsPerSample);
+    const __m128i offset = _mm_set1_epi32(binOffset);
+    const __m128i invalid = _mm_set1_epi32(-1);
+    const __m128i upper = _mm_set1_epi32(numBins);
+
+    int i = 0;
+
+    for (; i + 4 <= numSpikes; i += 4)
+    {
+        const __m256i samples = _mm256_loadu_si256((const __m256i*) (sampleNumbers + i));
+        const __m256i delta = _mm256_permutevar8x32_epi32(_mm256_sub_epi64(samples, event), lowHalves);
+
+        const __m256d x = _mm256_floor_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(delta)), scale));
+        const __m128i bins = _mm_add_epi32(_mm256_cvttpd_epi32(x), offset);
+
+        const __m128i valid = _mm_and_si128(_mm_cmpgt_epi32(bins, invalid),
+                                            _mm_cmplt_epi32(bins, upper));
+
+        _mm_storeu_si128((__m128i*) (binIndices + i), _mm_blendv_epi8(invalid, bins, valid));
+    }
+
+    BinningKernel::computeBinIndicesScalar(sampleNumbers + i, numSpikes - i, eventSampleNumber,
+                                           binsPerSample, binOffset, numBins, binIndices + i);
+}
+
+#endif
+
+BinningKernel::KernelFunction BinningKernel::getImplementation(Implementation implementation)
+{
+    switch (implementation)
+    {
+#if JUCE_INTEL
+        case AVX2:
+            return SystemStats::hasAVX2() ? computeBinIndicesAVX2 : nullptr;
+
+        case SSE41:
+            return SystemStats::hasSSE41() ? computeBinIndicesSSE41 : nullptr;
+#endif
+
+        case SCALAR:
+            return computeBinIndicesScalar;
+
+        default:
+            return nullptr;
+    }
+}
+
+BinningKernel::KernelFunction BinningKernel::selectKernel()
+{
+    if (KernelFunction kernel = getImplementation(AVX2))
+        return kernel;
+
+    if (KernelFunction kernel = getImplementation(SSE41))
+        return kernel;
+
+    return computeBinIndicesScalar;
+}
+
+void BinningKernel::computeBinIndices(const int64* sampleNumbers,
+                                      int numSpikes,
+                                      int64 eventSampleNumber,
+                                      double binsPerSample,
+                                      int binOffset,
+                                      int numBins,
+                                      int* binIndices)
+{
+    static const KernelFunction kernel = selectKernel();
+
+    kernel(sampleNumbers, numSpikes, eventSampleNumber, binsPerSample, binOffset, numBins, binIndices);
+}
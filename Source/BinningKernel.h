@@ -0,0 +1,81 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef BINNINGKERNEL_H_
+#define BINNINGKERNEL_H_
+
+#include <ProcessorHeaders.h>
+
+/**
+
+    Converts spike sample numbers into bin indices relative to an event.
+
+    For each spike, bin = floor((sample - event) * binsPerSample) + binOffset,
+    or -1 if that falls outside [0, numBins). Uses AVX2 or SSE4.1 when the
+    CPU supports them, and a scalar loop otherwise; all three give
+    identical results.
+
+*/
+class BinningKernel
+{
+public:
+
+    typedef void (*KernelFunction)(const int64*, int, int64, double, int, int, int*);
+
+    enum Implementation
+    {
+        SCALAR,
+        SSE41,
+        AVX2
+    };
+
+    /** Writes the bin index of each of numSpikes sample numbers to binIndices */
+    static void computeBinIndices(const int64* sampleNumbers,
+                                  int numSpikes,
+                                  int64 eventSampleNumber,
+                                  double binsPerSample,
+                                  int binOffset,
+                                  int numBins,
+                                  int* binIndices);
+
+    /** Scalar implementation, used for the remainder of each batch */
+    static void computeBinIndicesScalar(const int64* sampleNumbers,
+                                        int numSpikes,
+                                        int64 eventSampleNumber,
+                                        double binsPerSample,
+                                        int binOffset,
+                                        int numBins,
+                                        int* binIndices);
+
+    /** Returns one implementation, or nullptr if it is not compiled in
+        or not supported by this CPU (used to compare them) */
+    static KernelFunction getImplementation(Implementation implementation);
+
+private:
+
+    /** Returns the fastest implementation supported by this CPU */
+    static KernelFunction selectKernel();
+};
+
+
+#endif  // BINNINGKERNEL_H_
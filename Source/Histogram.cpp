@@ -24,21 +24,16 @@
 
 #include "OnlinePSTH.h"
 #include "OnlinePSTHDisplay.h"
+#include "PSTHEngine.h"
 
-Histogram::Histogram(OnlinePSTHDisplay* display_, const SpikeChannel* channel, const TriggerSource* source_)
-    : display(display_), sample_rate(channel->getSampleRate()), spikeChannel(channel), source(source_), baseColour(source_->colour),
-      streamId(channel->getStreamId()),
-      waitingForWindowToClose(false),
-      latestEventSampleNumber(0)
+Histogram::Histogram(OnlinePSTHDisplay* display_, PSTHAccumulator* accumulator_)
+    : display(display_), accumulator(accumulator_), 
+      spikeChannel(accumulator_->spikeChannel), source(accumulator_->source), baseColour(accumulator_->source->colour),
+      streamId(accumulator_->streamId)
 {
     
-    pre_ms = 0;
-    post_ms = 0;
-    bin_size_ms = 10;
-    
     infoLabel = std::make_unique<Label>("info label");
     infoLabel->setJustificationType(Justification::topLeft);
-    infoLabel->setText(channel->getName(), dontSendNotification);
     infoLabel->setColour(Label::textColourId, Colours::white);
     addAndMakeVisible(infoLabel.get());
 
@@ -46,14 +41,9 @@ Histogram::Histogram(OnlinePSTHDisplay* display_, const SpikeChannel* channel, c
     channelLabel->setFont(14);
     channelLabel->setJustificationType(Justification::topLeft);
     channelLabel->setColour(Label::textColourId, Colours::white);
-    String channelString = "";
-
-    for (auto ch : channel->getSourceChannels())
-        channelString += ch->getName() + ", ";
-
-    channelString = channelString.substring(0, channelString.length() - 2);
-    channelLabel->setText(channelString, dontSendNotification);
     addAndMakeVisible(channelLabel.get());
+
+    setSpikeChannel(spikeChannel);
     
     conditionLabel = std::make_unique<Label>("condition label");
     conditionLabel->setFont(16);
@@ -75,14 +65,26 @@ Histogram::Histogram(OnlinePSTHDisplay* display_, const SpikeChannel* channel, c
     addChildComponent(unitSelector.get());
 
     maxCounts.add(1);
-    uniqueSortedIds.add(0);
-    counts.add(Array<int>());
-    maxSortedId = 0;
 
-    clear();
+    refresh();
     
 }
 
+void Histogram::setSpikeChannel(const SpikeChannel* channel)
+{
+    spikeChannel = channel;
+
+    infoLabel->setText(channel->getName(), dontSendNotification);
+
+    String channelString = "";
+
+    for (auto ch : channel->getSourceChannels())
+        channelString += ch->getName() + ", ";
+
+    channelString = channelString.substring(0, channelString.length() - 2);
+    channelLabel->setText(channelString, dontSendNotification);
+}
+
 void Histogram::resized()
 {
     
@@ -144,66 +146,78 @@ void Histogram::resized()
 
 void Histogram::clear()
 {
-    relativeTimes.clear();
-    relativeTimeSortedIds.clear();
-    relativeTimeTrialIndices.clear();
-    maxCounts.fill(1);
+    accumulator->clear();
     
-    numTrials = 0;
+    maxCounts.fill(1);
 
-    recount();
+    refresh();
 }
 
-void Histogram::addSpike(int64 sample_number, int sortedId)
+void Histogram::refresh()
 {
+    if (accumulator->getVersion() == lastVersion)
+        return;
     
-    //const ScopedLock lock(mutex);
+    lastVersion = accumulator->getVersion();
     
-    newSpikeSampleNumbers.add(sample_number);
-    newSpikeSortedIds.add(sortedId);
+    updateUnits();
+    updateMaxCounts();
     
-    int sortedIdIndex = uniqueSortedIds.indexOf(sortedId);
+    repaint();
+}
+
+void Histogram::updateUnits()
+{
+    const Array<int>& sortedIds = accumulator->getSortedIds();
     
-    if (sortedIdIndex < 0)
+    for (int i = numUnits; i < accumulator->getNumUnits(); i++)
     {
-        sortedIdIndex = uniqueSortedIds.size();
-        uniqueSortedIds.add(sortedId);
+        const int sortedId = sortedIds[i];
+        
         if (sortedId > 0)
             unitSelector->addItem("Unit " + String(sortedId), sortedId + 1);
-
+        
         maxCounts.add(1);
-        counts.add(Array<int>());
-        maxSortedId = jmax(sortedId, maxSortedId);
     }
+    
+    numUnits = accumulator->getNumUnits();
 }
 
-void Histogram::addEvent(int64 sample_number)
+int Histogram::getCurrentUnitSlot() const
 {
-    if (!waitingForWindowToClose)
-    {
-        latestEventSampleNumber = sample_number;
+    const int slot = accumulator->getSortedIdIndex(currentUnitId);
 
-        startTimer(1010); // collect all spikes within 1 s
-        
-        waitingForWindowToClose = true;
-    }
-    
+    // the unit may have appeared since this histogram was last refreshed
+    return slot < numUnits ? slot : -1;
 }
 
-void Histogram::setWindowSizeMs(int pre, int post)
+void Histogram::updateMaxCounts()
 {
-    
-    pre_ms = pre;
-    post_ms = post;
-    
-    setBinSizeMs(bin_size_ms);
-    
-    recount();
+    // with a trial limit, old trials are evicted and the peak can fall,
+    // so the accumulator's maximum is followed down as well as up
+    const bool followMaxCounts = accumulator->getMaxTrials() > 0;
 
+    for (int i = 0; i < numUnits; i++)
+    {
+        const int maxCount = accumulator->getMaxCount(i);
+        
+        if (followMaxCounts && maxCount < maxCounts[i])
+            maxCounts.set(i, maxCount);
+
+        if (maxCount > maxCounts[i])
+        {
+            maxCounts.set(i, maxCount);
+            
+            if (overlayMode)
+                display->setMaxCountForElectrode(spikeChannel, accumulator->getSortedIds()[i], maxCount);
+        }
+    }
 }
 
 void Histogram::setPlotType(int plotType)
 {
+    plotRecency = false;
+
     if (plotType == 1)
     {
         plotRaster = false;
@@ -233,6 +247,20 @@ void Histogram::setPlotType(int plotType)
         plotHistogram = false;
         plotLine = true;
     }
+    else if (plotType == 6)
+    {
+        plotRaster = false;
+        plotHistogram = true;
+        plotLine = false;
+        plotRecency = true;
+    }
+    else if (plotType == 7)
+    {
+        plotRaster = false;
+        plotHistogram = false;
+        plotLine = true;
+        plotRecency = true;
+    }
 
     repaint();
 }
@@ -265,7 +293,9 @@ void Histogram::setOverlayMode(bool shouldOverlay)
 
     maxCounts.fill(1);
 
-    recount();
+    updateMaxCounts();
+    
+    repaint();
 
 }
 
@@ -280,116 +310,6 @@ void Histogram::setOverlayIndex(int index)
 
 }
 
-void Histogram::update()
-{
-
-    int index = 0;
-        
-    for (auto sample_number : newSpikeSampleNumbers)
-    {
-        double offsetMs = double(sample_number - latestEventSampleNumber) / sample_rate * 1000;
-            
-        if (offsetMs > -1000 && offsetMs < 1000)
-        {
-            relativeTimes.add(offsetMs);
-            relativeTimeSortedIds.add(newSpikeSortedIds[index]);
-            relativeTimeTrialIndices.add(int(numTrials));
-        }
-            
-        index++;
-    }
-        
-    numTrials++;
-        
-    if (numTrials == 1)
-        recount(true);
-    else
-        recount(false);
-
-}
-
-
-void Histogram::setBinSizeMs(int ms)
-{
-    bin_size_ms = ms;
-    
-    binEdges.clear();
-    
-    double bin_edge = (double) -pre_ms;
-    
-    while (bin_edge < post_ms)
-    {
-        binEdges.add(bin_edge);
-        bin_edge += (double) bin_size_ms;
-        
-    }
-    
-    binEdges.add(post_ms);
-    
-    recount();
-}
-
-
-void Histogram::recount(bool full)
-{
-    
-    const int nBins = binEdges.size() - 1;
-    
-    if (full)
-    {
-        for (int i = 0; i < counts.size(); i++)
-        {
-            counts.getReference(i).clear();
-            counts.getReference(i).insertMultiple(0, 0, nBins);
-        }
-    }
-
-    for (int i = 0; i < relativeTimes.size(); i++)
-    {
-
-        if (relativeTimeTrialIndices[i] == (numTrials - 1) || full)
-        {
-            for (int j = 0; j < nBins; j++)
-            {
-
-                if (relativeTimes[i] > binEdges[j] && relativeTimes[i] < binEdges[j + 1])
-                {
-                    int sortedIdIndex = uniqueSortedIds.indexOf(relativeTimeSortedIds[i]);
-                    int lastCount = counts[sortedIdIndex][j];
-                    int newCount = lastCount + 1;
-
-                    counts.getReference(sortedIdIndex).set(j, newCount);
-
-                    continue;
-                }
-
-            }
-        }
-
-    }
-    
-	for (int i = 0; i < counts.size(); i++)
-	{
-		int maxCount = 1;
-
-		for (int j = 0; j < nBins; j++)
-		{
-			maxCount = jmax(maxCount, counts[i][j]);
-		}
-
-        if (maxCount > maxCounts[i])
-        {
-            maxCounts.set(i, maxCount);
-
-            if (overlayMode)
-                display->setMaxCountForElectrode(spikeChannel, uniqueSortedIds[i], maxCount);
-        }
-		
-	}
-    
-    repaint();
-}
-
 void Histogram::paint(Graphics& g)
 {
 
@@ -402,8 +322,16 @@ void Histogram::paint(Graphics& g)
     if (shouldDrawBackground)
       g.fillAll(Colour(30,30,40));
     
-    const int nBins = binEdges.size() - 1;
+    const int pre_ms = accumulator->getPreWindowSizeMs();
+    const int post_ms = accumulator->getPostWindowSizeMs();
+    const int nBins = accumulator->getNumBins();
     float binWidth = histogramWidth / float(nBins);
+
+    // with more bins than pixels, each group of bins sharing a
+    // pixel column is drawn once, at the height of its largest bin
+    const int binsPerColumn = jmax(1, int(std::ceil(float(nBins) / jmax(1.0f, histogramWidth))));
+    
+    const int sortedIdIndex = getCurrentUnitSlot();
     
     if (plotHistogram)
     {
@@ -416,22 +344,22 @@ void Histogram::paint(Graphics& g)
         if (overlayMode)
             plotColour = plotColour.withAlpha(0.5f);
             
-        const int sortedIdIndex = uniqueSortedIds.indexOf(currentUnitId);
-            
         if (sortedIdIndex >= 0)
         {
-            for (int i = 0; i < nBins; i++)
+            for (int i = 0; i < nBins; i += binsPerColumn)
             {
-                if (hoverBin == i)
+                const int groupSize = jmin(binsPerColumn, nBins - i);
+
+                if (hoverBin >= i && hoverBin < i + groupSize)
                     g.setColour(plotColour.withAlpha(0.85f));
                 else
                     g.setColour(plotColour);
 
                 float x = binWidth * i;
-                float relativeHeight = float(counts[sortedIdIndex][i]) / float(maxCounts[sortedIdIndex]);
+                float relativeHeight = getGroupHeight(sortedIdIndex, i, groupSize);
                 float height = relativeHeight * histogramHeight;
                 float y = 10 + histogramHeight - height;
-                g.fillRect(x, y, binWidth + 0.5f, height);
+                g.fillRect(x, y, binWidth * groupSize + 0.5f, height);
 
             }
         }
@@ -440,52 +368,66 @@ void Histogram::paint(Graphics& g)
 
     if (plotLine)
     {
-        for (int sortedId = 0; sortedId < maxSortedId + 1; sortedId++)
+        if (sortedIdIndex >= 0)
         {
+            g.setColour(baseColour);
 
-            const int sortedIdIndex = uniqueSortedIds.indexOf(currentUnitId);
-
-            if (sortedIdIndex >= 0)
+            for (int i = 0; i + binsPerColumn < nBins; i += binsPerColumn)
             {
-                g.setColour(baseColour);
-
-                for (int i = 0; i < nBins - 1; i++)
-                {
+                const int nextGroupSize = jmin(binsPerColumn, nBins - i - binsPerColumn);
 
-                    float x1 = binWidth * i + binWidth / 2;
-                    float x2 = binWidth * (i + 1) + binWidth / 2;
-                    float relativeHeight1 = float(counts[sortedIdIndex][i]) / float(maxCounts[sortedIdIndex]);
-                    float height1 = relativeHeight1 * histogramHeight;
-                    float y1 = 9 + histogramHeight - height1;
-                    float relativeHeight2 = float(counts[sortedIdIndex][i + 1]) / float(maxCounts[sortedIdIndex]);
-                    float height2 = relativeHeight2 * histogramHeight;
-                    float y2 = 9 + histogramHeight - height2;
-                    g.drawLine(x1, y1, x2, y2, 2.0f);
+                float x1 = binWidth * i + binWidth * binsPerColumn / 2;
+                float x2 = binWidth * (i + binsPerColumn) + binWidth * nextGroupSize / 2;
+                float relativeHeight1 = getGroupHeight(sortedIdIndex, i, binsPerColumn);
+                float height1 = relativeHeight1 * histogramHeight;
+                float y1 = 9 + histogramHeight - height1;
+                float relativeHeight2 = getGroupHeight(sortedIdIndex, i + binsPerColumn, nextGroupSize);
+                float height2 = relativeHeight2 * histogramHeight;
+                float y2 = 9 + histogramHeight - height2;
+                g.drawLine(x1, y1, x2, y2, 2.0f);
 
-                    if (hoverBin == i)
-                        g.fillEllipse(x1 - 3, y1 - 3, 6, 6);
+                if (hoverBin >= i && hoverBin < i + binsPerColumn)
+                    g.fillEllipse(x1 - 3, y1 - 3, 6, 6);
 
-                }
             }
-			
         }
     }
     
+    // counts in bins that some trials did not cover (because they closed
+    // before the window was widened) are shaded, as they are not comparable
+    if (!plotRecency && !accumulator->allTrialsCoverWindow())
+    {
+        const int numTrials = accumulator->getNumTrials();
+
+        g.setColour(Colours::black.withAlpha(0.4f));
+
+        for (int i = 0; i < nBins; i += binsPerColumn)
+        {
+            const int groupSize = jmin(binsPerColumn, nBins - i);
+
+            if (accumulator->getNumTrialsInBin(i) < numTrials
+                || accumulator->getNumTrialsInBin(i + groupSize - 1) < numTrials)
+                g.fillRect(binWidth * i, 0.0f, binWidth * groupSize + 0.5f, histogramHeight + 10);
+        }
+    }
+
     if (plotRaster)
     {
-        int firstTrial = numTrials - maxRasterTrials;
+        const TrialStore& trials = accumulator->getTrials();
         
-        if (firstTrial < 0)
-            firstTrial = 0;
+        const int firstTrial = accumulator->getFirstTrialIndex()
+                               + jmax(0, accumulator->getNumTrials() - maxRasterTrials);
         
-        for (int index = 0; index < relativeTimes.size(); index++)
+        for (int index = trials.findFirstOfTrial(firstTrial); index < trials.size(); index++)
         {
-            if (relativeTimeTrialIndices[index] >= firstTrial && relativeTimeSortedIds[index] == currentUnitId)
+            if (trials.getUnitSlot(index) == sortedIdIndex)
             {
-                if (relativeTimes[index] > -pre_ms && relativeTimes[index] < post_ms)
+                const double relativeTime = accumulator->sampleOffsetToMs(trials.getSampleOffset(index));
+
+                if (relativeTime > -pre_ms && relativeTime < post_ms)
                 {
-                    const float yPos = float(relativeTimeTrialIndices[index] - firstTrial) / float(maxRasterTrials) * (histogramHeight+10);
-                    const float xPos = (relativeTimes[index] + float(pre_ms)) / float(pre_ms + post_ms) * histogramWidth;
+                    const float yPos = float(trials.getTrialIndex(index) - firstTrial) / float(maxRasterTrials) * (histogramHeight+10);
+                    const float xPos = (relativeTime + float(pre_ms)) / float(pre_ms + post_ms) * histogramWidth;
 
                     if (!overlayMode)
                         g.setColour(Colours::white.withAlpha(0.8f));
@@ -505,29 +447,72 @@ void Histogram::paint(Graphics& g)
 }
 
 
+float Histogram::getGroupHeight(int sortedIdIndex, int firstBin, int numBins)
+{
+    if (plotRecency)
+    {
+        // recency-weighted counts rise and fall, so they are
+        // scaled to their current maximum rather than the largest seen
+        const float maxCount = accumulator->getMaxRecencyCount(sortedIdIndex);
+
+        if (maxCount <= 0.0f)
+            return 0.0f;
+
+        float count = 0.0f;
+
+        for (int bin = firstBin; bin < firstBin + numBins; bin++)
+            count = jmax(count, accumulator->getRecencyCount(sortedIdIndex, bin));
+
+        return count / maxCount;
+    }
+
+    int count = 0;
+
+    for (int bin = firstBin; bin < firstBin + numBins; bin++)
+        count = jmax(count, accumulator->getCount(sortedIdIndex, bin));
+
+    return float(count) / float(maxCounts[sortedIdIndex]);
+}
+
 void Histogram::mouseMove(const MouseEvent &event)
 {
     
     if (event.getPosition().x < histogramWidth)
     {
-        const int nBins = binEdges.size() - 1;
+        const int nBins = accumulator->getNumBins();
         float binWidth = histogramWidth / float(nBins);
         
         hoverBin = (int) (float(event.getPosition().x) / binWidth);
         
         float firing_rate;
 
-		const int sortedIdIndex = uniqueSortedIds.indexOf(currentUnitId);
+		const int sortedIdIndex = getCurrentUnitSlot();
+        // trials closed with a narrower window did not cover every bin
+        const int numTrials = accumulator->getNumTrialsInBin(hoverBin);
         
-        if (numTrials > 0)
-            firing_rate = float(counts[sortedIdIndex][hoverBin] / numTrials) / (float(bin_size_ms) / 1000.0f) ;
+        if (plotRecency && sortedIdIndex >= 0)
+            firing_rate = accumulator->getRecencyCount(sortedIdIndex, hoverBin)
+                          / (float(accumulator->getBinSizeMs()) / 1000.0f);
+        else if (numTrials > 0 && sortedIdIndex >= 0)
+            firing_rate = float(accumulator->getCount(sortedIdIndex, hoverBin)) / float(numTrials) 
+                          / (float(accumulator->getBinSizeMs()) / 1000.0f);
         else
             firing_rate = 0;
         
+        const Array<double>& binEdges = accumulator->getBinEdges();
+        
         String firingRateString = String(firing_rate, 2) + " Hz";
         String binString = "[" + String(binEdges[hoverBin]) +
         "," + String(binEdges[hoverBin+1]) + "] ms";
         
+        if (!plotRecency && numTrials < accumulator->getNumTrials())
+            binString += "\n" + String(numTrials) + " of " + String(accumulator->getNumTrials()) + " trials";
+
+        // the spike budget, not the trial limit, decides how many trials are kept
+        if (!plotRecency && accumulator->isLimitedBySpikes())
+            binString += "\n" + String(accumulator->getNumTrials()) + " of "
+                         + String(accumulator->getMaxTrials()) + " trials kept (spike limit)";
+
         hoverLabel->setText(firingRateString + "\n" + binString, dontSendNotification);
 
         repaint();
@@ -543,26 +528,18 @@ void Histogram::mouseExit(const MouseEvent &event)
 }
 
 
-void Histogram::timerCallback()
-{
-    stopTimer();
-    
-    waitingForWindowToClose = false;
-    
-    update();
-}
-
 void Histogram::comboBoxChanged(ComboBox* comboBox)
 {
     
+    const int sortedId = accumulator->getSortedIds()[comboBox->getSelectedItemIndex()];
+    
     if (overlayMode)
     {
-        display->setUnitForElectrode(spikeChannel, uniqueSortedIds[comboBox->getSelectedItemIndex()]);
+        display->setUnitForElectrode(spikeChannel, sortedId);
     }
     else {
-        currentUnitId = uniqueSortedIds[comboBox->getSelectedItemIndex()];
+        currentUnitId = sortedId;
 
-        recount();
         repaint();
     }
 
@@ -572,21 +549,22 @@ void Histogram::setUnitId(int unitId)
 {
 	currentUnitId = unitId;
 
-	if (uniqueSortedIds.contains(currentUnitId))
-        unitSelector->setSelectedItemIndex(uniqueSortedIds.indexOf(currentUnitId));
+    const int sortedIdIndex = accumulator->getSortedIdIndex(currentUnitId);
+    
+	if (sortedIdIndex >= 0)
+        unitSelector->setSelectedItemIndex(sortedIdIndex);
 	else
         unitSelector->setSelectedItemIndex(0);
 
-    recount();
 	repaint();
 }
 
 void Histogram::setMaxCount(int unitId, int count)
 {
 
-    const int sortedIdIndex = uniqueSortedIds.indexOf(unitId);
+    const int sortedIdIndex = accumulator->getSortedIdIndex(unitId);
     
-	if (maxCounts[sortedIdIndex] < count)
+	if (sortedIdIndex >= 0 && sortedIdIndex < numUnits && maxCounts[sortedIdIndex] < count)
 	{
 		maxCounts.set(sortedIdIndex, count);
 		repaint();
@@ -597,29 +575,5 @@ void Histogram::setMaxCount(int unitId, int count)
 
 DynamicObject Histogram::getInfo()
 {
-    DynamicObject info;
-
-    info.setProperty(Identifier("electrode"),
-        var(spikeChannel->getName()));
-    info.setProperty(Identifier("condition"),
-        var(source->name));
-    info.setProperty(Identifier("color"),
-        var(source->colour.toString()));
-    info.setProperty(Identifier("trial_count"),
-        var(int(numTrials)));
-    
-    Array<var> bin_edges;
-    Array<var> spike_counts;
-
-    for (int bin = 0; bin < binEdges.size() - 1; bin++)
-    {
-
-        bin_edges.add(binEdges[bin]);
-        spike_counts.add(counts[0][bin]);
-    }
-
-    info.setProperty(Identifier("bin_edges"), bin_edges);
-    info.setProperty(Identifier("spike_counts"), spike_counts);
-
-	return info;
-}
\ No newline at end of file
+	return accumulator->getInfo();
+}
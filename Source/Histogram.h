@@ -30,6 +30,7 @@
 
 class TriggerSource;
 class OnlinePSTHDisplay;
+class PSTHAccumulator;
 
 /**
  
@@ -38,13 +39,12 @@ class OnlinePSTHDisplay;
  */
 class Histogram :
     public Component,
-    public Timer,
     public ComboBox::Listener
 {
 public:
     
     /** Constructor */
-    Histogram(OnlinePSTHDisplay*, const SpikeChannel* channel, const TriggerSource* triggerSource);
+    Histogram(OnlinePSTHDisplay*, PSTHAccumulator* accumulator);
     
     /** Destructor */
     ~Histogram() { }
@@ -55,22 +55,14 @@ public:
     /** Called when histogram is resized */
     void resized();
     
-    /** Adds a spike time */
-    void addSpike(int64 sample_number, int sortedId);
-    
-    /** Adds an event time*/
-    void addEvent(int64 sample_number);
-    
     /** Clears the display*/
     void clear();
     
-    /** Sets the =window size*/
-    void setWindowSizeMs(int pre_ms, int post_ms);
+    /** Repaints if the underlying accumulator has changed */
+    void refresh();
     
-    /** Sets the pre-event window size*/
-    void setBinSizeMs(int ms);
-    
-    /** Sets the plot type (histogram, raster, raster + histogram) */
+    /** Sets the plot type (histogram, raster, raster + histogram, line, line + raster,
+        recency-weighted histogram, recency-weighted line) */
     void setPlotType(int plotType);
 
     /** Sets the plot colour */
@@ -79,6 +71,9 @@ public:
     /** Sets the condition name */
     void setSourceName(String name);
 
+    /** Sets the spike channel, after a signal chain update */
+    void setSpikeChannel(const SpikeChannel* channel);
+
     /** Sets the unit ID */
     void setUnitId(int unitId);
 
@@ -103,9 +98,6 @@ public:
     /** Listens for ComboBox callbacks */
     void comboBoxChanged(ComboBox* comboBox) override;
     
-    /** Called by OnlinePSTHDisplay after event window closes */
-    void update();
-    
     /** Stream ID for this histogram */
     uint16 streamId;
 
@@ -115,13 +107,22 @@ public:
     /** Return info about this histogram */
     DynamicObject getInfo();
 
+    /** Returns the accumulator drawn by this histogram */
+    PSTHAccumulator* getAccumulator() const { return accumulator; }
+
 private:
     
-    /** Updates histogram after event window closes*/
-    void timerCallback();
+    /** Adds newly seen units to the unit selector */
+    void updateUnits();
+    
+    /** Updates the max counts used to scale the plot */
+    void updateMaxCounts();
+
+    /** Returns the height (0 to 1) of the largest count among numBins bins starting at firstBin */
+    float getGroupHeight(int sortedIdIndex, int firstBin, int numBins);
     
-    /** Recomputes bin counts */
-    void recount(bool full=true);
+    /** Returns the slot of the selected unit, or -1 if it has no counts yet */
+    int getCurrentUnitSlot() const;
     
     std::unique_ptr<Label> infoLabel;
     std::unique_ptr<Label> channelLabel;
@@ -129,35 +130,21 @@ private:
     std::unique_ptr<Label> hoverLabel;
     std::unique_ptr<ComboBox> unitSelector;
     
-    Array<int64> newSpikeSampleNumbers;
-    Array<int> newSpikeSortedIds;
-    
-    int64 latestEventSampleNumber;
-    
-    Array<int> uniqueSortedIds;
-    
-    Array<double> binEdges;
-    
     bool plotHistogram = true;
     bool plotRaster = false;
     bool plotLine = false;
+    bool plotRecency = false;
     
-    int maxSortedId = 0;
     int maxRasterTrials = 30;
     
-    Array<double> relativeTimes;
-    Array<int> relativeTimeTrialIndices;
-    Array<int> relativeTimeSortedIds;
     Colour baseColour;
     
-    Array<Array<int>> counts;
-
+    PSTHAccumulator* accumulator;
     const TriggerSource* source;
     OnlinePSTHDisplay* display;
     
-    int pre_ms;
-    int post_ms;
-    int bin_size_ms;
+    int64 lastVersion = -1;
+    int numUnits = 1;
 
     float histogramWidth;
     float histogramHeight;
@@ -171,14 +158,8 @@ private:
     
     int hoverBin = -1;
     
-    bool waitingForWindowToClose;
-    
-    float numTrials = 0;
-
     int currentUnitId = 0;
     
-    const double sample_rate;
-    
 };
 
 
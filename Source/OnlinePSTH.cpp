@@ -31,23 +31,44 @@
 
 OnlinePSTH::OnlinePSTH()
     : GenericProcessor("Online PSTH"),
-      canvas(nullptr)
+      canvas(nullptr),
+      publishedSnapshot(nullptr),
+      snapshotVersionInUse(0),
+      engine(&eventQueue)
 {
+    updateTriggerDispatch();
+
+    lastSynchronizedEdges.assign(256, { -1, 0.0 });
 
     addIntParameter(Parameter::GLOBAL_SCOPE,
                     "pre_ms",
                     "Size of the PSTH window in ms",
-                    500, 10, 1000);
+                    500, 10, 10000);
     
     addIntParameter(Parameter::GLOBAL_SCOPE,
                     "post_ms",
                     "Size of the PSTH window in ms",
-                    500, 10, 1000);
+                    500, 10, 10000);
     
-    addIntParameter(Parameter::GLOBAL_SCOPE,
+    addFloatParameter(Parameter::GLOBAL_SCOPE,
                     "bin_size",
                     "Size of the PSTH bins in ms",
-                    10, 1, 100);
+                    10.0f, 0.1f, 100.0f, 0.1f);
+    
+    addIntParameter(Parameter::GLOBAL_SCOPE,
+                    "max_trials",
+                    "Number of most recent trials in the PSTH (0 = all trials)",
+                    0, 0, 100000);
+    
+    addIntParameter(Parameter::GLOBAL_SCOPE,
+                    "half_life",
+                    "Half-life of the recency-weighted PSTH, in trials",
+                    20, 1, 10000);
+    
+    addIntParameter(Parameter::GLOBAL_SCOPE,
+                    "retention_s",
+                    "How long spikes are kept for aligning late triggers, in seconds",
+                    10, 1, 3600);
     
     addIntParameter(Parameter::GLOBAL_SCOPE,
                     "trigger_line",
@@ -70,28 +91,40 @@ AudioProcessorEditor* OnlinePSTH::createEditor()
 
 void OnlinePSTH::parameterValueChanged(Parameter* param)
 {
-   if (param->getName().equalsIgnoreCase("pre_ms"))
-    {
-        if (canvas != nullptr)
-            canvas->setWindowSizeMs((int) param->getValue(),
-                                    (int) getParameter("post_ms")->getValue());
-    }
-    else if (param->getName().equalsIgnoreCase("post_ms"))
+   if (param->getName().equalsIgnoreCase("pre_ms")
+       || param->getName().equalsIgnoreCase("post_ms"))
     {
+        engine.setWindowSizeMs(getPreWindowSizeMs(), getPostWindowSizeMs());
+
         if (canvas != nullptr)
-            canvas->setWindowSizeMs((int) getParameter("pre_ms")->getValue(),
-                                    (int) getParameter("post_ms")->getValue());
+            canvas->setWindowSizeMs(getPreWindowSizeMs(), getPostWindowSizeMs());
     }
     else if (param->getName().equalsIgnoreCase("bin_size"))
     {
+        engine.setBinSizeMs(getBinSizeMs());
+
         if (canvas != nullptr)
-            canvas->setBinSizeMs((int) param->getValue());
+            canvas->setBinSizeMs(getBinSizeMs());
    }
+    else if (param->getName().equalsIgnoreCase("max_trials"))
+    {
+        engine.setMaxTrials(getMaxTrials());
+    }
+    else if (param->getName().equalsIgnoreCase("half_life"))
+    {
+        engine.setRecencyHalfLife(getRecencyHalfLife());
+    }
+    else if (param->getName().equalsIgnoreCase("retention_s"))
+    {
+        engine.setSpikeRetentionMs(getSpikeRetentionSeconds() * 1000);
+    }
     else if (param->getName().equalsIgnoreCase("trigger_line"))
    {
        if (currentTriggerSource != nullptr)
        {
 		   currentTriggerSource->line = (int)param->getValue();
+
+           updateTriggerDispatch();
        }
     }
     else if (param->getName().equalsIgnoreCase("trigger_type"))
@@ -100,10 +133,7 @@ void OnlinePSTH::parameterValueChanged(Parameter* param)
        {
            currentTriggerSource->type = (TriggerType)(int)param->getValue();
 
-           if (currentTriggerSource->type == TTL_TRIGGER)
-               currentTriggerSource->canTrigger = true;
-           else
-               currentTriggerSource->canTrigger = false;
+           updateTriggerDispatch();
        }
        
    }
@@ -121,9 +151,24 @@ int OnlinePSTH::getPostWindowSizeMs()
 }
 
 
-int OnlinePSTH::getBinSizeMs()
+float OnlinePSTH::getBinSizeMs()
 {
-    return (int) getParameter("bin_size")->getValue();
+    return (float) getParameter("bin_size")->getValue();
+}
+
+int OnlinePSTH::getMaxTrials()
+{
+    return (int) getParameter("max_trials")->getValue();
+}
+
+int OnlinePSTH::getRecencyHalfLife()
+{
+    return (int) getParameter("half_life")->getValue();
+}
+
+int OnlinePSTH::getSpikeRetentionSeconds()
+{
+    return (int) getParameter("retention_s")->getValue();
 }
 
 Array<TriggerSource*> OnlinePSTH::getTriggerSources()
@@ -142,10 +187,12 @@ TriggerSource* OnlinePSTH::addTriggerSource(int line, TriggerType type)
 {
 	String name = "Condition " + String(nextConditionIndex++);
     
-	TriggerSource* source = new TriggerSource(this, name, line, type);
+	TriggerSource* source = new TriggerSource(this, nextTriggerSourceId++, name, line, type);
     source->colour = TriggerSource::getColourForLine(triggerSources.size());
 	triggerSources.add(source);
 
+    updateTriggerDispatch();
+
     //LOGD("Adding ", name);
 
 	return source;
@@ -157,6 +204,62 @@ void OnlinePSTH::removeTriggerSources(Array<TriggerSource*> sources)
 	{
 		triggerSources.removeObject(source);
 	}
+
+    updateTriggerDispatch();
+}
+
+void OnlinePSTH::updateTriggerDispatch()
+{
+    TriggerSnapshot* snapshot = new TriggerSnapshot();
+
+    snapshot->ttlDispatch.resize(256);
+
+    for (int i = 0; i < triggerSources.size(); i++)
+    {
+        const TriggerSource* source = triggerSources[i];
+
+        snapshot->types.push_back(source->type);
+
+        if (source->type != TTL_TRIGGER)
+        {
+            const String name = source->name.toLowerCase();
+
+            if (!snapshot->messageDispatch.contains(name))
+                snapshot->messageDispatch.set(name, Array<int>());
+
+            snapshot->messageDispatch.getReference(name).add(i);
+        }
+
+        if (source->type == MSG_TRIGGER)
+            continue;
+
+        if (source->line >= 0 && source->line < (int) snapshot->ttlDispatch.size())
+            snapshot->ttlDispatch[source->line].push_back(i);
+    }
+
+    snapshot->armed.resize(triggerSources.size(), false);
+
+    const TriggerSnapshot* previous = triggerSnapshots.getLast();
+    snapshot->version = previous != nullptr ? previous->version + 1 : 1;
+
+    triggerSnapshots.add(snapshot);
+    publishedSnapshot.store(snapshot, std::memory_order_release);
+
+    // with no blocks being processed, nothing can still hold an older snapshot
+    if (!isAcquiring)
+        snapshotVersionInUse.store(snapshot->version, std::memory_order_release);
+
+    releaseTriggerSnapshots();
+}
+
+void OnlinePSTH::releaseTriggerSnapshots()
+{
+    // the processing thread only ever loads the current snapshot, so once
+    // it reports a version, every older snapshot is unreachable
+    const int64 versionInUse = snapshotVersionInUse.load(std::memory_order_acquire);
+
+    while (triggerSnapshots.size() > 1 && triggerSnapshots[0]->version < versionInUse)
+        triggerSnapshots.remove(0);
 }
 
 
@@ -198,6 +301,8 @@ void OnlinePSTH::setTriggerSourceName(TriggerSource* source, String name, bool u
 {
     source->name = name;
 
+    updateTriggerDispatch();
+
     if (updateEditor)
     {
         OnlinePSTHEditor* editor = (OnlinePSTHEditor*)getEditor();
@@ -238,38 +343,214 @@ void OnlinePSTH::setTriggerSourceTriggerType(TriggerSource* source, TriggerType
     
 }
 
+void OnlinePSTH::updateSettings()
+{
+    streamClocks.clear();
+
+    for (auto stream : getDataStreams())
+        streamClocks.push_back({ stream->getStreamId(), stream->getSampleRate(), 0, 0.0, 0 });
+
+    updateAccumulators();
+}
+
+void OnlinePSTH::updateAccumulators()
+{
+    engine.prepareToUpdate();
+
+    engine.setWindowSizeMs(getPreWindowSizeMs(), getPostWindowSizeMs());
+    engine.setBinSizeMs(getBinSizeMs());
+    engine.setMaxTrials(getMaxTrials());
+    engine.setRecencyHalfLife(getRecencyHalfLife());
+    engine.setSpikeRetentionMs(getSpikeRetentionSeconds() * 1000);
+
+    for (int i = 0; i < getTotalSpikeChannels(); i++)
+    {
+        const SpikeChannel* channel = getSpikeChannel(i);
+
+        if (!channel->isValid())
+            continue;
+
+        for (int j = 0; j < triggerSources.size(); j++)
+            engine.addAccumulator(channel, i, triggerSources[j], j);
+    }
+
+    // histograms of accumulators that are about to be
+    // freed have to go before the accumulators do
+    if (canvas != nullptr)
+        canvas->updateHistograms(engine.getAccumulators());
+
+    engine.finishUpdate();
+}
+
 void OnlinePSTH::process(AudioBuffer<float>& buffer)
 {
+    activeSnapshot = publishedSnapshot.load(std::memory_order_acquire);
+    snapshotVersionInUse.store(activeSnapshot->version, std::memory_order_release);
+
+    for (auto& clock : streamClocks)
+    {
+        clock.firstSample = getFirstSampleNumberForBlock(clock.streamId);
+        clock.firstTimestamp = getFirstTimestampForBlock(clock.streamId);
+        clock.numSamples = (int) getNumSamplesInBlock(clock.streamId);
+    }
+
     checkForEvents(true);
+
+    for (auto& clock : streamClocks)
+        getBlockBatch().addClock(clock.streamId, clock.firstSample + clock.numSamples);
+
+    flushBlockBatch();
+}
+
+PSTHBlockBatch& OnlinePSTH::getBlockBatch()
+{
+    if (blockBatch.isFull())
+        flushBlockBatch();
+
+    return blockBatch;
+}
+
+void OnlinePSTH::flushBlockBatch()
+{
+    blockBatch.sort();
+
+    eventQueue.push(blockBatch);
+
+    blockBatch.clear();
+}
+
+bool OnlinePSTH::startAcquisition()
+{
+    blockBatch.clear();
+    eventQueue.reset();
+
+    lastSynchronizedEdges.assign(256, { -1, 0.0 });
+
+    isAcquiring = true;
+
+    engine.start();
+
+    return true;
+}
+
+bool OnlinePSTH::stopAcquisition()
+{
+    engine.stop();
+
+    // processing has stopped, so only the current snapshot needs to be kept
+    isAcquiring = false;
+    activeSnapshot = nullptr;
+    snapshotVersionInUse.store(publishedSnapshot.load()->version);
+    releaseTriggerSnapshots();
+
+    if (eventQueue.getNumDropped() > 0)
+        LOGD("Online PSTH dropped ", eventQueue.getNumDropped(), " of ",
+             eventQueue.getNumPushed() + eventQueue.getNumDropped(), " spikes/events (queue full)");
+
+    if (engine.getNumExpiredTrials() > 0)
+        LOGD("Online PSTH skipped ", engine.getNumExpiredTrials(), " trials triggered after their spikes were released");
+
+    if (engine.getNumDroppedSpikes() > 0)
+        LOGD("Online PSTH released ", engine.getNumDroppedSpikes(), " spikes early (spike rate above the retention limit)");
+
+    return true;
 }
 
 void OnlinePSTH::handleBroadcastMessage(String message)
 {
     LOGD("Online PSTH received ", message);
 
-    for (auto source : triggerSources)
+    String name = message.toLowerCase();
+
+    // "<name>@<seconds>" stamps the message with the time of the
+    // event on the synchronized timeline
+    bool hasTimestamp = false;
+    double timestamp = 0.0;
+
+    TriggerSnapshot* snapshot = activeSnapshot;
+
+    if (snapshot == nullptr)
+        return;
+
+    if (!snapshot->messageDispatch.contains(name))
     {
-        if (message.equalsIgnoreCase(source->name))
+        const String stamp = name.fromLastOccurrenceOf("@", false, false).trim();
+
+        if (stamp.isEmpty() || !stamp.containsOnly("0123456789."))
+            return;
+
+        name = name.upToLastOccurrenceOf("@", false, false).trim();
+        timestamp = stamp.getDoubleValue();
+        hasTimestamp = true;
+
+        if (!snapshot->messageDispatch.contains(name))
+            return;
+    }
+
+    for (auto sourceIndex : snapshot->messageDispatch.getReference(name))
+    {
+        if (snapshot->types[sourceIndex] == TTL_AND_MSG_TRIGGER)
         {
-            if (source->type == TTL_AND_MSG_TRIGGER)
-            {
-                source->canTrigger = true;
-            }
-            else if (source->type == MSG_TRIGGER)
+            snapshot->armed[sourceIndex] = true;
+        }
+        else if (snapshot->types[sourceIndex] == MSG_TRIGGER)
+        {
+            for (auto& clock : streamClocks)
             {
-                if (canvas != nullptr)
-                {
-                    for (auto stream : getDataStreams())
-                    {
-                        const uint16 streamId = stream->getStreamId();
-                        canvas->pushEvent(source, streamId, getFirstSampleNumberForBlock(streamId));
-                    }
-                }
+                int jitter;
+                const int64 sample_number = getMessageSampleNumber(clock, hasTimestamp, timestamp, jitter);
+
+                getBlockBatch().addEvent(sourceIndex, clock.streamId, sample_number, jitter);
             }
         }
     }
 }
 
+int64 OnlinePSTH::getMessageSampleNumber(const StreamClock& clock, bool hasTimestamp, double timestamp, int& jitter)
+{
+    if (hasTimestamp && clock.isSynchronized())
+    {
+        jitter = 0;
+
+        return clock.getSampleNumber(timestamp);
+    }
+
+    // the message arrived while the samples of this block were being
+    // acquired, so its middle is the best estimate
+    jitter = (clock.numSamples + 1) / 2;
+
+    return clock.firstSample + clock.numSamples / 2;
+}
+
+const StreamClock* OnlinePSTH::findStreamClock(uint16 streamId) const
+{
+    for (auto& clock : streamClocks)
+    {
+        if (clock.streamId == streamId)
+            return &clock;
+    }
+
+    return nullptr;
+}
+
+void OnlinePSTH::addAlignedEvent(int sourceIndex, const StreamClock& origin, int64 sample_number)
+{
+    getBlockBatch().addEvent(sourceIndex, origin.streamId, sample_number);
+
+    if (!origin.isSynchronized())
+        return;
+
+    // the event keeps its own sample number on its stream, and is
+    // placed on the others through the synchronized timestamps
+    const double timestamp = origin.getTimestamp(sample_number);
+
+    for (auto& clock : streamClocks)
+    {
+        if (&clock != &origin && clock.isSynchronized())
+            getBlockBatch().addEvent(sourceIndex, clock.streamId, clock.getSampleNumber(timestamp));
+    }
+}
+
 String OnlinePSTH::handleConfigMessage(String message)
 {
     LOGD("Online PSTH received ", message);
@@ -366,24 +647,54 @@ void OnlinePSTH::timerCallback()
 void OnlinePSTH::handleTTLEvent(TTLEventPtr event)
 {
     
-    for (auto source : triggerSources)
+    if (!event->getState())
+        return;
+
+    const StreamClock* origin = findStreamClock(event->getStreamId());
+
+    if (origin == nullptr)
+        return;
+
+    // a trigger copied onto several synchronized streams arrives once per
+    // stream, but each copy is already aligned to every synchronized stream,
+    // so copies of the last edge from the other streams are dropped;
+    // unsynchronized streams only ever trigger their own histograms
+    if (origin->isSynchronized())
     {
-        if (event->getLine() == source->line && event->getState() && source->canTrigger)
+        const double timestamp = origin->getTimestamp(event->getSampleNumber());
+
+        SynchronizedEdge& lastEdge = lastSynchronizedEdges[event->getLine()];
+
+        if (lastEdge.streamId >= 0 && lastEdge.streamId != origin->streamId
+            && std::abs(timestamp - lastEdge.timestamp) < duplicateEdgeSeconds)
+            return;
+
+        lastEdge = { origin->streamId, timestamp };
+    }
+
+    TriggerSnapshot* snapshot = activeSnapshot;
+
+    for (auto sourceIndex : snapshot->ttlDispatch[event->getLine()])
+    {
+        if (snapshot->types[sourceIndex] == TTL_AND_MSG_TRIGGER)
         {
-            if (canvas != nullptr)
-                canvas->pushEvent(source, event->getStreamId(), event->getSampleNumber());
+            if (!snapshot->armed[sourceIndex])
+                continue;
 
-            if (source->type == TTL_AND_MSG_TRIGGER)
-				source->canTrigger = false;
+            snapshot->armed[sourceIndex] = false;
         }
+
+        addAlignedEvent(sourceIndex, *origin, event->getSampleNumber());
     }
     
 }
 
 void OnlinePSTH::handleSpike(SpikePtr spike)
 {
-   if (canvas != nullptr)
-       canvas->pushSpike(spike->getChannelInfo(), spike->getSampleNumber(), spike->getSortedId());
+    const SpikeChannel* channel = spike->getChannelInfo();
+
+    getBlockBatch().addSpike(channel->getGlobalIndex(), channel->getStreamId(),
+                             spike->getSampleNumber(), spike->getSortedId());
 }
 
 
@@ -421,4 +732,6 @@ void OnlinePSTH::loadCustomParametersFromXml(XmlElement* xml)
 				source->colour = Colour::fromString(savedColour);
 		}
 	}
+
+    updateTriggerDispatch();
 }
\ No newline at end of file
@@ -26,6 +26,10 @@
 
 #include <ProcessorHeaders.h>
 
+#include "PSTHEngine.h"
+#include "SpikeEventQueue.h"
+
+#include <atomic>
 #include <vector>
 #include <map>
 
@@ -46,13 +50,8 @@ enum TriggerType
 class TriggerSource
 {
 public:
-    TriggerSource(OnlinePSTH* processor_, String name_, int line_, TriggerType type_) :
-		processor(processor_), name(name_), line(line_), type(type_) {
-    
-        if (type == TTL_TRIGGER)
-            canTrigger = true;
-        else
-            canTrigger = false;
+    TriggerSource(OnlinePSTH* processor_, int id_, String name_, int line_, TriggerType type_) :
+		processor(processor_), id(id_), name(name_), line(line_), type(type_) {
 
         colour = getColourForLine(line);
     
@@ -75,16 +74,69 @@ public:
     }
 
 
+    /** Identifies the source for as long as it exists; unlike the name, it never changes */
+    const int id;
+
 	String name;
 	int line;
 	TriggerType type;
     OnlinePSTH* processor;
-    bool canTrigger;
     Colour colour;
 };
 
+/**
+    Immutable copy of the trigger configuration, read by the processing
+    thread. A new snapshot is published whenever a source changes.
+*/
+struct TriggerSnapshot
+{
+    /** Trigger type of each source, in processor order */
+    std::vector<TriggerType> types;
+
+    /** Indices of the TTL-triggered sources, indexed by TTL line */
+    std::vector<std::vector<int>> ttlDispatch;
+
+    /** Indices of the message-triggered sources, indexed by lower-case name */
+    HashMap<String, Array<int>> messageDispatch;
+
+    /** Whether each TTL_AND_MSG source has been armed by a message
+        (the only state written by the processing thread) */
+    std::vector<uint8> armed;
+
+    int64 version;
+};
+
 class OnlinePSTHCanvas;
 
+/**
+    Sample clock of one data stream for the current block, used to
+    convert event times between streams
+*/
+struct StreamClock
+{
+    uint16 streamId;
+    double sampleRate;
+    int64 firstSample;
+    double firstTimestamp;
+    int numSamples;
+
+    /** Streams that are not synchronized report negative timestamps,
+        and cannot be converted to or from the other streams */
+    bool isSynchronized() const { return firstTimestamp >= 0.0; }
+
+    /** Converts a sample number on this stream to a synchronized timestamp */
+    double getTimestamp(int64 sample_number) const
+    {
+        return firstTimestamp + double(sample_number - firstSample) / sampleRate;
+    }
+
+    /** Converts a synchronized timestamp to the nearest sample number on this stream */
+    int64 getSampleNumber(double timestamp) const
+    {
+        return firstSample + int64(std::round((timestamp - firstTimestamp) * sampleRate));
+    }
+};
+
 /**
     
     Aligns spike times with incoming TTL events to generate real-time peri-stimulus
@@ -108,8 +160,20 @@ public:
     /** Used to alter parameters of data acquisition. */
     void parameterValueChanged(Parameter* param) override;
 
-    /** Calls checkForEvents */
+    /** Calls checkForEvents and advances the sample clock of each stream */
     void process(AudioBuffer<float>& buffer) override;
+
+    /** Clears the spike/event queue and starts the PSTH engine */
+    bool startAcquisition() override;
+
+    /** Stops the PSTH engine and reports any records dropped during acquisition */
+    bool stopAcquisition() override;
+
+    /** Called when the signal chain is updated */
+    void updateSettings() override;
+
+    /** Creates PSTH accumulators for every valid spike channel and trigger source */
+    void updateAccumulators();
     
     /** Returns the PSTH pre-event window size in ms */
     int getPreWindowSizeMs();
@@ -118,11 +182,23 @@ public:
     int getPostWindowSizeMs();
     
     /** Returns the PSTH bin size in ms*/
-    int getBinSizeMs();
+    float getBinSizeMs();
+    
+    /** Returns the number of most recent trials in each PSTH (0 = all trials) */
+    int getMaxTrials();
+    
+    /** Returns the half-life of the recency-weighted PSTH, in trials */
+    int getRecencyHalfLife();
+    
+    /** Returns how long spikes are kept for aligning late triggers, in seconds */
+    int getSpikeRetentionSeconds();
     
     /** Pointer to the display canvas */
     OnlinePSTHCanvas* canvas;
 
+    /** Returns the engine that accumulates the PSTHs */
+    PSTHEngine* getEngine() { return &engine; }
+
     /** Returns an array of current trigger sources */
 	Array<TriggerSource*> getTriggerSources();
 
@@ -168,19 +244,84 @@ private:
         int lowerBound,
         int upperBound);
     
-    /** Pushes incoming events to the canvas */
+    /** Adds incoming events to the current block's batch */
     void handleTTLEvent (TTLEventPtr event) override;
 
-    /** Pushes incoming spikes to the canvas */
+    /** Adds incoming spikes to the current block's batch */
     void handleSpike(SpikePtr spike) override;
 
     /** Updates editor after receiving config message */
     void timerCallback() override;
 
+    /** Returns the sample number of a message-triggered event on one stream, and
+        sets jitter to its uncertainty in samples (0 if the message has a timestamp) */
+    int64 getMessageSampleNumber(const StreamClock& clock, bool hasTimestamp, double timestamp, int& jitter);
+
+    /** Returns the clock of an input stream for the current block, or nullptr */
+    const StreamClock* findStreamClock(uint16 streamId) const;
+
+    /** Adds an event from one stream to the batch; events from a synchronized
+        stream are aligned to every other synchronized stream as well */
+    void addAlignedEvent(int sourceIndex, const StreamClock& origin, int64 sample_number);
+
+    /** Returns the batch for the current block, flushing it first if full */
+    PSTHBlockBatch& getBlockBatch();
+
+    /** Sorts the current block's records and hands them to the queue */
+    void flushBlockBatch();
+
+    /** Publishes a new snapshot of the trigger sources to the processing thread */
+    void updateTriggerDispatch();
+
+    /** Deletes snapshots that the processing thread can no longer be reading */
+    void releaseTriggerSnapshots();
+
     OwnedArray<TriggerSource> triggerSources;
 
+    /** Published snapshots, oldest first; the last one is current (message thread only) */
+    OwnedArray<TriggerSnapshot> triggerSnapshots;
+
+    /** The current snapshot */
+    std::atomic<TriggerSnapshot*> publishedSnapshot;
+
+    /** Version of the snapshot the processing thread loaded for its current block */
+    std::atomic<int64> snapshotVersionInUse;
+
+    /** Snapshot used for the current block (processing thread only) */
+    TriggerSnapshot* activeSnapshot = nullptr;
+
+    /** Whether the processing thread may be reading snapshots (message thread only) */
+    bool isAcquiring = false;
+
+    SpikeEventQueue eventQueue;
+
+    /** Spikes and events received during the current block */
+    PSTHBlockBatch blockBatch;
+
+    /** Sample clock of each input stream, updated at the start of every block */
+    std::vector<StreamClock> streamClocks;
+
+    /** Last rising edge on a TTL line from a synchronized stream */
+    struct SynchronizedEdge
+    {
+        int streamId;
+        double timestamp;
+    };
+
+    /** Last synchronized edge on each TTL line, with streamId -1 if none has
+        been seen since acquisition started (processing thread only, except on start) */
+    std::vector<SynchronizedEdge> lastSynchronizedEdges;
+
+    /** Edges on one line from different synchronized streams closer than this
+        are copies of the same trigger, in seconds */
+    static constexpr double duplicateEdgeSeconds = 0.002;
+
+    PSTHEngine engine;
+
     int nextConditionIndex = 1;
 
+    int nextTriggerSourceId = 1;
+
     TriggerSource* currentTriggerSource = nullptr;
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(OnlinePSTH);
@@ -45,6 +45,8 @@ OptionsBar::OptionsBar(OnlinePSTHCanvas* canvas_, OnlinePSTHDisplay* display_, T
     plotTypeSelector->addItem("Histogram + Raster", 3);
     plotTypeSelector->addItem("Line", 4);
     plotTypeSelector->addItem("Line + Raster", 5);
+    plotTypeSelector->addItem("Recency Histogram", 6);
+    plotTypeSelector->addItem("Recency Line", 7);
     plotTypeSelector->setSelectedId(1, dontSendNotification);
     plotTypeSelector->addListener(this);
     addAndMakeVisible(plotTypeSelector.get());
@@ -215,6 +217,12 @@ OnlinePSTHCanvas::OnlinePSTHCanvas()
 }
 
 
+void OnlinePSTHCanvas::refresh()
+{
+    display->refresh();
+}
+
+
 void OnlinePSTHCanvas::refreshState()
 {
     resized();
@@ -255,31 +263,20 @@ void OnlinePSTHCanvas::setWindowSizeMs(int pre_ms_, int post_ms_)
     pre_ms = pre_ms_;
     post_ms = post_ms_;
     
-    display->setWindowSizeMs(pre_ms, post_ms);
     scale->setWindowSizeMs(pre_ms, post_ms);
+    display->refresh();
     
     repaint();
 }
 
-void OnlinePSTHCanvas::setBinSizeMs(int bin_size)
-{
-    display->setBinSizeMs(bin_size);
-}
-
-void OnlinePSTHCanvas::pushEvent(const TriggerSource* source, uint16 streamId, int64 sample_number)
+void OnlinePSTHCanvas::setBinSizeMs(float bin_size)
 {
-    display->pushEvent(source, streamId, sample_number);
+    display->refresh();
 }
 
-
-void OnlinePSTHCanvas::pushSpike(const SpikeChannel* channel, int64 sample_number, int sortedId)
-{
-    display->pushSpike(channel, sample_number, sortedId);
-}
-
-void OnlinePSTHCanvas::addSpikeChannel(const SpikeChannel* channel, const TriggerSource* source)
+void OnlinePSTHCanvas::updateHistograms(const Array<PSTHAccumulator*>& accumulators)
 {
-    display->addSpikeChannel(channel, source);
+    display->updateHistograms(accumulators);
 }
 
 void OnlinePSTHCanvas::updateColourForSource(const TriggerSource* source)
@@ -292,11 +289,6 @@ void OnlinePSTHCanvas::updateConditionName(const TriggerSource* source)
     display->updateConditionName(source);
 }
 
-void OnlinePSTHCanvas::prepareToUpdate()
-{
-    display->prepareToUpdate();
-}
-
 
 
 void OnlinePSTHCanvas::saveCustomParametersToXml(XmlElement* xml)
@@ -29,6 +29,7 @@
 #include "OnlinePSTHDisplay.h"
 #include "Timescale.h"
 
+class OnlinePSTH;
 class TriggerSource;
 class OnlinePSTHCanvas;
 
@@ -104,7 +105,7 @@ public:
     /** Renders the Visualizer on each animation callback cycle
         Called instead of Juce's "repaint()" to avoid redrawing underlying components
         if not necessary.*/
-    void refresh() { }
+    void refresh();
 
     /** Called when the Visualizer's tab becomes visible after being hidden .*/
     void refreshState();
@@ -123,16 +124,10 @@ public:
     void setWindowSizeMs(int pre_ms, int post_ms);
     
     /** Sets the bin size*/
-    void setBinSizeMs(int bin_size);
+    void setBinSizeMs(float bin_size);
     
-    /** Add an event to the queue */
-    void pushEvent(const TriggerSource* source, uint16 streamId, int64 sample_number);
-    
-    /** Add a spike to the queue */
-    void pushSpike(const SpikeChannel* channel, int64 sample_number, int sortedId);
-    
-    /** Adds a spike channel */
-    void addSpikeChannel(const SpikeChannel* channel, const TriggerSource* source);
+    /** Matches the histograms to the accumulators, keeping existing ones */
+    void updateHistograms(const Array<PSTHAccumulator*>& accumulators);
 
     /** Changes source colour */
     void updateColourForSource(const TriggerSource* source);
@@ -140,9 +135,6 @@ public:
     /** Changes source name */
     void updateConditionName(const TriggerSource* source);
 
-    /** Prepare for update*/
-    void prepareToUpdate();
-    
     /** Save plot type*/
     void saveCustomParametersToXml(XmlElement* xml) override;
     
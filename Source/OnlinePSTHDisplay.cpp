@@ -22,6 +22,7 @@
 
 #include "OnlinePSTHDisplay.h"
 #include "OnlinePSTH.h"
+#include "PSTHEngine.h"
 
 OnlinePSTHDisplay::OnlinePSTHDisplay()
 {
@@ -33,20 +34,11 @@ void OnlinePSTHDisplay::refresh()
 {
     for (auto hist : histograms)
     {
-        hist->repaint();
+        hist->refresh();
     }
 }
 
 
-void OnlinePSTHDisplay::prepareToUpdate()
-{
-    histograms.clear();
-    triggerSourceMap.clear();
-    spikeChannelMap.clear();
-    setBounds(0, 0, getWidth(), 0);
-}
-
-
 void OnlinePSTHDisplay::resized()
 {
     totalHeight = 0;
@@ -104,30 +96,61 @@ void OnlinePSTHDisplay::resized()
 }
 
 
-void OnlinePSTHDisplay::addSpikeChannel(const SpikeChannel* channel, const TriggerSource* source)
+void OnlinePSTHDisplay::updateHistograms(const Array<PSTHAccumulator*>& accumulators)
 {
+    // a histogram holds display state (unit selection, scaling),
+    // so it lives exactly as long as its accumulator
+    std::map<PSTHAccumulator*, Histogram*> existing;
 
-    Histogram* h = new Histogram(this, channel, source);
-    h->setPlotType(plotType);
+    for (int i = histograms.size(); --i >= 0;)
+    {
+        Histogram* h = histograms.removeAndReturn(i);
+        existing[h->getAccumulator()] = h;
+    }
 
-    //LOGD("Display adding ", channel->getName(), " for ", source->name);
-    
-    histograms.add(h);
-    triggerSourceMap[source].add(h);
-    spikeChannelMap[channel].add(h);
+    triggerSourceMap.clear();
+    spikeChannelMap.clear();
 
-    int numRows = histograms.size() / numColumns + 1;
+    for (auto accumulator : accumulators)
+    {
+        Histogram* h;
 
-    totalHeight = (numRows + 1) * (histogramHeight + 10);
+        auto it = existing.find(accumulator);
 
-    addAndMakeVisible(h);
+        if (it != existing.end())
+        {
+            h = it->second;
+            existing.erase(it);
+
+            h->setSpikeChannel(accumulator->spikeChannel);
+        }
+        else
+        {
+            h = new Histogram(this, accumulator);
+            h->setPlotType(plotType);
+
+            addAndMakeVisible(h);
+        }
+
+        histograms.add(h);
+        triggerSourceMap[accumulator->source].add(h);
+        spikeChannelMap[accumulator->spikeChannel].add(h);
+    }
+
+    for (auto& entry : existing)
+        delete entry.second;
+
+    resized();
 }
 
 void OnlinePSTHDisplay::updateColourForSource(const TriggerSource* source)
 {
-    Array<Histogram*> h = triggerSourceMap[source];
+    auto it = triggerSourceMap.find(source);
+
+    if (it == triggerSourceMap.end())
+        return;
 
-    for (auto hist : h)
+    for (auto hist : it->second)
     {
         hist->setSourceColour(source->colour);
     }
@@ -135,9 +158,12 @@ void OnlinePSTHDisplay::updateColourForSource(const TriggerSource* source)
 
 void OnlinePSTHDisplay::updateConditionName(const TriggerSource* source)
 {
-    Array<Histogram*> h = triggerSourceMap[source];
+    auto it = triggerSourceMap.find(source);
 
-    for (auto hist : h)
+    if (it == triggerSourceMap.end())
+        return;
+
+    for (auto hist : it->second)
     {
         hist->setSourceName(source->name);
     }
@@ -167,7 +193,12 @@ void OnlinePSTHDisplay::setConditionOverlay(bool overlay_)
 
 void OnlinePSTHDisplay::setUnitForElectrode(const SpikeChannel* channel, int unitId)
 {
-	for (auto hist : spikeChannelMap[channel])
+	auto it = spikeChannelMap.find(channel);
+
+	if (it == spikeChannelMap.end())
+		return;
+
+	for (auto hist : it->second)
 	{
 		hist->setUnitId(unitId);
 	}
@@ -176,34 +207,18 @@ void OnlinePSTHDisplay::setUnitForElectrode(const SpikeChannel* channel, int uni
 
 void OnlinePSTHDisplay::setMaxCountForElectrode(const SpikeChannel* channel, int unitId, int maxCount)
 {
-    for (auto hist : spikeChannelMap[channel])
-    {
-        hist->setMaxCount(unitId, maxCount);
-    }
-}
+    auto it = spikeChannelMap.find(channel);
 
+    if (it == spikeChannelMap.end())
+        return;
 
-void OnlinePSTHDisplay::setWindowSizeMs(int pre_ms, int post_ms_)
-{
-    
-    post_ms = post_ms_;
-    
-    for (auto hist : histograms)
-    {
-        hist->setWindowSizeMs(pre_ms, post_ms);
-    }
-}
-
-void OnlinePSTHDisplay::setBinSizeMs(int bin_size)
-{
-    for (auto hist : histograms)
+    for (auto hist : it->second)
     {
-        hist->setBinSizeMs(bin_size);
+        hist->setMaxCount(unitId, maxCount);
     }
 }
 
 
-
 void OnlinePSTHDisplay::setPlotType(int plotType_)
 {
     
@@ -215,27 +230,6 @@ void OnlinePSTHDisplay::setPlotType(int plotType_)
     }
 }
 
-void OnlinePSTHDisplay::pushEvent(const TriggerSource* source, uint16 streamId, int64 sample_number)
-{
-    
-    for (auto hist : triggerSourceMap[source])
-    {
-        if (hist->streamId == streamId)
-            hist->addEvent(sample_number);
-    }
-    
-}
-
-void OnlinePSTHDisplay::pushSpike(const SpikeChannel* channel, int64 sample_number, int sortedId)
-{
-
-    for (auto hist : spikeChannelMap[channel])
-    {
-        hist->addSpike(sample_number, sortedId);
-    }
-}
-
-
 int OnlinePSTHDisplay::getDesiredHeight()
 {
     return totalHeight;
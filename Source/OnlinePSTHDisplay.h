@@ -48,31 +48,18 @@ public:
     /** Destructor */
     ~OnlinePSTHDisplay() { }
     
-    /** Renders the Visualizer on each animation callback cycle
-        Called instead of Juce's "repaint()" to avoid redrawing underlying components
-        if not necessary.*/
+    /** Repaints any histograms whose accumulators have changed */
     void refresh();
     
     /** Called when component changes size*/
     void resized();
 
-    /** Sets the overall window size*/
-    void setWindowSizeMs(int pre_ms, int post_ms);
-    
-    /** Sets the bin size*/
-    void setBinSizeMs(int bin_size);
-    
     /** Sets the bin size*/
     void setPlotType(int plotType);
     
-    /** Add an event to the queue */
-    void pushEvent(const TriggerSource* source, uint16 streamId, int64 sample_number);
-    
-    /** Add a spike to the queue */
-    void pushSpike(const SpikeChannel* channel, int64 sample_number, int sortedId);
-    
-    /** Adds a spike channel for a given trigger source */
-    void addSpikeChannel(const SpikeChannel* channel, const TriggerSource* source);
+    /** Matches the histograms to the accumulators, keeping the existing
+        histograms of accumulators that are still in use */
+    void updateHistograms(const Array<PSTHAccumulator*>& accumulators);
 
     /** Changes source colour */
     void updateColourForSource(const TriggerSource* source);
@@ -95,9 +82,6 @@ public:
     /** Sets the max count in overlay mode */
     void setMaxCountForElectrode(const SpikeChannel* channel, int unitId, int maxCount);
     
-    /** Prepare for update*/
-    void prepareToUpdate();
-    
     /** Returns the desired height for this component*/
     int getDesiredHeight();
     
@@ -121,7 +105,6 @@ private:
 
     bool overlayConditions = false;
     
-    int post_ms;
     int plotType = 1;
 };
 
@@ -31,7 +31,7 @@
 #include <stdio.h>
 
 OnlinePSTHEditor::OnlinePSTHEditor(GenericProcessor* parentNode)
-    : VisualizerEditor(parentNode, "PSTH", 225), 
+    : VisualizerEditor(parentNode, "PSTH", 435), 
       canvas(nullptr),
       currentConfigWindow(nullptr)
 
@@ -39,6 +39,9 @@ OnlinePSTHEditor::OnlinePSTHEditor(GenericProcessor* parentNode)
     addTextBoxParameterEditor("pre_ms", 20, 30);
     addTextBoxParameterEditor("post_ms", 20, 75);
     addTextBoxParameterEditor("bin_size", 125, 30);
+    addTextBoxParameterEditor("max_trials", 230, 30);
+    addTextBoxParameterEditor("half_life", 230, 75);
+    addTextBoxParameterEditor("retention_s", 335, 30);
 
     configureButton = std::make_unique<UtilityButton>("configure", titleFont);
     configureButton->addListener(this);
@@ -66,24 +69,9 @@ void OnlinePSTHEditor::updateSettings()
     if (canvas == nullptr)
         return;
     
-    canvas->prepareToUpdate();
-    
     OnlinePSTH* processor = (OnlinePSTH*) getProcessor();
 
-    for (int i = 0; i < processor->getTotalSpikeChannels(); i++)
-    {
-        const SpikeChannel* channel = processor->getSpikeChannel(i);
-            
-        for (auto source : processor->getTriggerSources())
-        {
-            if (channel->isValid())
-            {
-                canvas->addSpikeChannel(channel, source);
-                //LOGD("Editor adding ", channel->getName(), " for ", source->name);
-            }
-                
-        }
-    }
+    canvas->updateHistograms(processor->getEngine()->getAccumulators());
 
     canvas->setWindowSizeMs(processor->getPreWindowSizeMs(),
                             processor->getPostWindowSizeMs());
@@ -158,6 +146,8 @@ void OnlinePSTHEditor::addTriggerSources(PopupConfigurationWindow* window, Array
         
 	}
 
+    processor->updateAccumulators();
+
     if (window != nullptr)
         window->update(processor->getTriggerSources());
 
@@ -171,6 +161,8 @@ void OnlinePSTHEditor::removeTriggerSources(PopupConfigurationWindow* window, Ar
 
     processor->removeTriggerSources(triggerSourcesToRemove);
 
+    processor->updateAccumulators();
+
     if (window != nullptr)
         window->update(processor->getTriggerSources());
 
@@ -0,0 +1,904 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PSTHEngine.h"
+
+#include "BinningKernel.h"
+#include "OnlinePSTH.h"
+
+#include <algorithm>
+#include <cmath>
+
+PSTHAccumulator::PSTHAccumulator(const SpikeChannel* channel, const TriggerSource* source_,
+                                 UnitIndex* units_, SpikeIndex* spikes_, BinMapCache* binMaps_)
+    : streamId(channel->getStreamId()),
+      spikeChannel(channel),
+      source(source_),
+      units(units_),
+      spikes(spikes_),
+      binMaps(binMaps_),
+      baseBinScratch(1024),
+      pre_ms(0),
+      post_ms(0),
+      bin_size_ms(10),
+      binWidthMs(10),
+      sample_rate(channel->getSampleRate())
+{
+    setRecencyHalfLife(20.0f);
+
+    addUnits();
+
+    setBinSizeMs(bin_size_ms);
+}
+
+void PSTHAccumulator::clear()
+{
+    trials.clear();
+
+    numTrials = 0;
+    firstTrial = 0;
+
+    limitedBySpikes = false;
+
+    maxTrialJitter = 0;
+
+    trialWindowRuns.clear();
+    trialWindowCounts.clear();
+
+    // the base counts shrink back to the current window
+    basePreMs = pre_ms;
+    basePostMs = post_ms;
+
+    for (auto& unitBaseCounts : baseCounts)
+        unitBaseCounts.setNumBins(getNumBaseBins());
+
+    for (auto& unitRecencyCounts : recencyBase)
+        unitRecencyCounts.setNumBins(getNumBaseBins());
+
+    recencyScale = 1.0;
+    recencyWeight = 0.0;
+
+    setBinSizeMs(bin_size_ms);
+}
+
+void PSTHAccumulator::addUnits()
+{
+    while (counts.size() < units->getNumUnits())
+    {
+        const int numStoredBins = hasBaseBins() ? 0 : getNumBins();
+
+        counts.add(Array<int>());
+        counts.getReference(counts.size() - 1).insertMultiple(0, 0, numStoredBins);
+        maxCounts.add(1);
+
+        recencyCounts.add(Array<float>());
+        recencyCounts.getReference(recencyCounts.size() - 1).insertMultiple(0, 0.0f, numStoredBins);
+        maxRecencyCounts.add(0.0f);
+
+        baseCounts.emplace_back(getNumBaseBins());
+        recencyBase.emplace_back(getNumBaseBins());
+    }
+
+    version++;
+}
+
+void PSTHAccumulator::setWindowSizeMs(int pre, int post)
+{
+    pre_ms = pre;
+    post_ms = post;
+
+    extendBaseRange();
+
+    setBinSizeMs(bin_size_ms);
+}
+
+void PSTHAccumulator::extendBaseRange()
+{
+    // trials closed with a shorter window have no spikes in the
+    // added range, so the existing counts only need padding
+    const int extraPreMs = jmax(0, pre_ms - basePreMs);
+    const int extraPostMs = jmax(0, post_ms - basePostMs);
+
+    if (extraPreMs == 0 && extraPostMs == 0)
+        return;
+
+    // unless the range was shrunk after trials with a longer window
+    bool trialsBeyondRange = false;
+
+    for (const auto& window : trialWindowCounts)
+    {
+        if (window.first.first > basePreMs || window.first.second > basePostMs)
+            trialsBeyondRange = true;
+    }
+
+    basePreMs += extraPreMs;
+    basePostMs += extraPostMs;
+
+    // a long range drops to the 1 ms base before it is extended,
+    // so the rows never hold a long range at 0.1 ms
+    const int binsPerMs = jmin(baseBinsPerMs, getMaxBaseBinsPerMs());
+
+    for (auto& unitRecencyCounts : recencyBase)
+    {
+        if (binsPerMs != baseBinsPerMs)
+            unitRecencyCounts.resample(baseBinsPerMs, binsPerMs);
+
+        unitRecencyCounts.extend(extraPreMs * binsPerMs, extraPostMs * binsPerMs);
+    }
+
+    if (binsPerMs != baseBinsPerMs || trialsBeyondRange)
+    {
+        baseBinsPerMs = binsPerMs;
+        rebuildBaseCounts();
+    }
+    else
+    {
+        for (auto& unitBaseCounts : baseCounts)
+            unitBaseCounts.extend(extraPreMs * baseBinsPerMs, extraPostMs * baseBinsPerMs);
+    }
+}
+
+void PSTHAccumulator::shrinkBaseRange()
+{
+    // spikes outside the window stay in the trials, but the
+    // recency counts outside it are lost
+    for (auto& unitRecencyCounts : recencyBase)
+        unitRecencyCounts.trim((basePreMs - pre_ms) * baseBinsPerMs, (basePostMs - post_ms) * baseBinsPerMs);
+
+    basePreMs = pre_ms;
+    basePostMs = post_ms;
+
+    rebuildBaseCounts();
+}
+
+void PSTHAccumulator::setBinSizeMs(float ms)
+{
+    bin_size_ms = ms;
+
+    // whole-ms bins are counted on a 1 ms base; anything finer needs the
+    // 0.1 ms base, which is only used while the base range is short enough
+    const int binSizeTenths = jmax(1, roundToInt(ms * 10.0f));
+
+    // the base range only grows while windows change, so once the window
+    // fits the 0.1 ms base again, a sub-ms bin size drops the rest of it
+    // rather than staying rounded to 1 ms until the next clear
+    if (binSizeTenths % 10 != 0
+        && pre_ms + post_ms <= maxFineBaseRangeMs
+        && basePreMs + basePostMs > maxFineBaseRangeMs)
+    {
+        shrinkBaseRange();
+    }
+    const int binsPerMs = (binSizeTenths % 10 == 0) ? 1 : getMaxBaseBinsPerMs();
+
+    if (binsPerMs != baseBinsPerMs)
+    {
+        // the recency counts have no trials to rebuild from, so they are resampled
+        for (auto& unitRecencyCounts : recencyBase)
+            unitRecencyCounts.resample(baseBinsPerMs, binsPerMs);
+
+        baseBinsPerMs = binsPerMs;
+        rebuildBaseCounts();
+    }
+
+    const int binSize = (baseBinsPerMs == 1) ? jmax(1, (binSizeTenths + 5) / 10) : binSizeTenths;
+    binWidthMs = float(binSize) / float(baseBinsPerMs);
+    const int preBins = pre_ms * baseBinsPerMs;
+    const int postBins = post_ms * baseBinsPerMs;
+
+    // all bins have the same width, except for the last one,
+    // which ends at post_ms and can be shorter
+    const int nBins = (preBins + postBins + binSize - 1) / binSize;
+
+    binEdges.clearQuick();
+
+    for (int bin = 0; bin < nBins; bin++)
+        binEdges.add(double(bin * binSize - preBins) / baseBinsPerMs);
+
+    binEdges.add(post_ms);
+
+    baseToBin = binMaps->getMap(getNumBaseBins(), basePreMs * baseBinsPerMs, preBins, postBins, binSize);
+
+    firstBinBaseBin = (binSize == 1) ? (basePreMs - pre_ms) * baseBinsPerMs : -1;
+
+    rebin();
+}
+
+void PSTHAccumulator::rebuildBaseCounts()
+{
+    for (auto& unitBaseCounts : baseCounts)
+        unitBaseCounts.setNumBins(getNumBaseBins());
+
+    const double baseBinsPerSample = getBaseBinsPerSample();
+    const int basePreBins = basePreMs * baseBinsPerMs;
+
+    for (int i = 0; i < trials.size(); i++)
+    {
+        const int baseBin = int(std::floor(double(trials.getSampleOffset(i)) * baseBinsPerSample)) + basePreBins;
+
+        if (baseBin >= 0 && baseBin < getNumBaseBins())
+            baseCounts[trials.getUnitSlot(i)].increment(baseBin);
+    }
+}
+
+bool PSTHAccumulator::addTrial(int64 event_sample_number, int jitter)
+{
+    const int64 firstSample = event_sample_number - int64(pre_ms * sample_rate / 1000);
+    const int64 lastSample = event_sample_number + int64(post_ms * sample_rate / 1000);
+
+    if (firstSample < spikes->getHorizon())
+        return false;
+
+    maxTrialJitter = jmax(maxTrialJitter, jitter);
+
+    const WindowSize window(pre_ms, post_ms);
+
+    if (trialWindowRuns.empty() || trialWindowRuns.back().first != window)
+        trialWindowRuns.emplace_back(window, 0);
+
+    trialWindowRuns.back().second++;
+    trialWindowCounts[window]++;
+
+    decayRecencyCounts();
+
+    const int first = spikes->findFirst(firstSample);
+    const int last = spikes->findFirst(lastSample + 1);
+
+    const double baseBinsPerSample = getBaseBinsPerSample();
+
+    for (int i = first; i < last;)
+    {
+        const int64* sampleNumbers;
+        const int* unitSlots;
+
+        const int numSpikes = spikes->getRun(i, jmin(last - i, (int) baseBinScratch.size()),
+                                             sampleNumbers, unitSlots);
+
+        BinningKernel::computeBinIndices(sampleNumbers, numSpikes, event_sample_number,
+                                         baseBinsPerSample, basePreMs * baseBinsPerMs, getNumBaseBins(),
+                                         baseBinScratch.data());
+
+        for (int j = 0; j < numSpikes; j++)
+        {
+            const int baseBin = baseBinScratch[j];
+
+            if (baseBin < 0)
+                continue;
+
+            trials.add(int32(sampleNumbers[j] - event_sample_number), unitSlots[j], numTrials);
+
+            addToCounts(unitSlots[j], baseBin);
+        }
+
+        i += numSpikes;
+    }
+
+    numTrials++;
+
+    evictTrials();
+
+    version++;
+
+    return true;
+}
+
+void PSTHAccumulator::setRecencyHalfLife(float halfLife)
+{
+    recencyDecay = std::pow(0.5, 1.0 / jmax(1.0f, halfLife));
+}
+
+void PSTHAccumulator::decayRecencyCounts()
+{
+    // decaying every bin would cost O(bins) per trial; instead the decay
+    // goes into the shared scale, and new spikes are added at 1 / scale
+    recencyScale *= recencyDecay;
+    recencyWeight = recencyWeight * recencyDecay + (1.0 - recencyDecay);
+
+    if (recencyScale < minRecencyScale)
+    {
+        const float factor = float(recencyScale);
+
+        for (int i = 0; i < recencyCounts.size(); i++)
+        {
+            recencyBase[i].scale(factor);
+
+            for (auto& value : recencyCounts.getReference(i))
+                value *= factor;
+
+            maxRecencyCounts.set(i, maxRecencyCounts[i] * factor);
+        }
+
+        recencyScale = 1.0;
+    }
+
+    recencyIncrement = float((1.0 - recencyDecay) / recencyScale);
+}
+
+void PSTHAccumulator::setMaxTrials(int maxTrials_)
+{
+    maxTrials = maxTrials_;
+
+    evictTrials();
+
+    version++;
+}
+
+void PSTHAccumulator::setMaxStoredSpikes(int maxSpikes)
+{
+    maxStoredSpikes = maxSpikes;
+
+    evictTrials();
+
+    version++;
+}
+
+void PSTHAccumulator::evictTrials()
+{
+    limitedBySpikes = false;
+
+    if (maxTrials <= 0)
+        return;
+
+    // the spike limit bounds memory when trials are unusually dense,
+    // but the most recent trial is always kept
+    while (getNumTrials() > maxTrials
+           || (trials.size() > maxStoredSpikes && getNumTrials() > 1))
+    {
+        if (getNumTrials() <= maxTrials)
+            limitedBySpikes = true;
+
+        removeOldestTrial();
+    }
+}
+
+void PSTHAccumulator::removeOldestTrial()
+{
+    const int numSpikes = trials.findFirstOfTrial(firstTrial + 1);
+
+    const double baseBinsPerSample = getBaseBinsPerSample();
+    const int basePreBins = basePreMs * baseBinsPerMs;
+
+    int firstStaleUnit = counts.size();
+    int lastStaleUnit = -1;
+
+    for (int i = 0; i < numSpikes; i++)
+    {
+        const int baseBin = int(std::floor(double(trials.getSampleOffset(i)) * baseBinsPerSample)) + basePreBins;
+
+        if (baseBin < 0 || baseBin >= getNumBaseBins())
+            continue;
+
+        const int unitSlot = trials.getUnitSlot(i);
+
+        baseCounts[unitSlot].decrement(baseBin);
+
+        const int bin = (*baseToBin)[baseBin];
+
+        if (bin < 0)
+            continue;
+
+        int previousCount;
+
+        if (hasBaseBins())
+            previousCount = baseCounts[unitSlot].get(baseBin) + 1;
+        else
+            previousCount = counts.getReference(unitSlot).getReference(bin)--;
+
+        // only a unit whose peak bin lost a spike needs its maximum rescanned
+        if (previousCount == maxCounts[unitSlot])
+        {
+            firstStaleUnit = jmin(firstStaleUnit, unitSlot);
+            lastStaleUnit = jmax(lastStaleUnit, unitSlot);
+        }
+    }
+
+    trials.removeTrialsBefore(firstTrial + 1);
+
+    auto window = trialWindowCounts.find(trialWindowRuns.front().first);
+
+    if (--window->second == 0)
+        trialWindowCounts.erase(window);
+
+    if (--trialWindowRuns.front().second == 0)
+        trialWindowRuns.pop_front();
+
+    firstTrial++;
+
+    for (int unitSlot = firstStaleUnit; unitSlot <= lastStaleUnit; unitSlot++)
+    {
+        int maxCount = 1;
+
+        for (int bin = 0; bin < getNumBins(); bin++)
+            maxCount = jmax(maxCount, getCount(unitSlot, bin));
+
+        maxCounts.set(unitSlot, maxCount);
+    }
+}
+
+void PSTHAccumulator::rebin()
+{
+    // bin edges fall on the base grid, so every base bin lies
+    // entirely within one bin and the sums are exact
+    const int nBins = getNumBins();
+
+    maxCounts.fill(1);
+    maxRecencyCounts.fill(0.0f);
+
+    for (int i = 0; i < counts.size(); i++)
+    {
+        Array<int>& unitCounts = counts.getReference(i);
+        Array<float>& unitRecencyCounts = recencyCounts.getReference(i);
+
+        if (hasBaseBins())
+        {
+            // the bins are read from the base counts, so no copy is kept
+            unitCounts.clear();
+            unitRecencyCounts.clear();
+        }
+        else
+        {
+            unitCounts.clearQuick();
+            unitCounts.insertMultiple(0, 0, nBins);
+
+            baseCounts[i].sumInto(baseToBin->getRawDataPointer(), unitCounts.getRawDataPointer());
+
+            unitRecencyCounts.clearQuick();
+            unitRecencyCounts.insertMultiple(0, 0.0f, nBins);
+
+            recencyBase[i].sumInto(baseToBin->getRawDataPointer(), unitRecencyCounts.getRawDataPointer());
+        }
+
+        for (int bin = 0; bin < nBins; bin++)
+        {
+            if (getCount(i, bin) > maxCounts[i])
+                maxCounts.set(i, getCount(i, bin));
+
+            if (getRecencyValue(i, bin) > maxRecencyCounts[i])
+                maxRecencyCounts.set(i, getRecencyValue(i, bin));
+        }
+    }
+
+    version++;
+}
+
+void PSTHAccumulator::addToCounts(int unitSlot, int baseBin)
+{
+    baseCounts[unitSlot].increment(baseBin);
+    recencyBase[unitSlot].add(baseBin, recencyIncrement);
+
+    const int bin = (*baseToBin)[baseBin];
+
+    if (bin < 0)
+        return;
+
+    int count;
+    float recencyCount;
+
+    if (hasBaseBins())
+    {
+        count = baseCounts[unitSlot].get(baseBin);
+        recencyCount = recencyBase[unitSlot].get(baseBin);
+    }
+    else
+    {
+        count = ++counts.getReference(unitSlot).getReference(bin);
+        recencyCount = (recencyCounts.getReference(unitSlot).getReference(bin) += recencyIncrement);
+    }
+
+    if (count > maxCounts[unitSlot])
+        maxCounts.set(unitSlot, count);
+
+    if (recencyCount > maxRecencyCounts[unitSlot])
+        maxRecencyCounts.set(unitSlot, recencyCount);
+}
+
+int PSTHAccumulator::getNumTrialsInBin(int bin) const
+{
+    // windows only change when the user edits them, so there are
+    // only ever a few distinct ones to check
+    const double binStart = binEdges[bin];
+    const double binEnd = binEdges[bin + 1];
+
+    int numTrialsInBin = 0;
+
+    for (const auto& window : trialWindowCounts)
+    {
+        if (-window.first.first <= binStart && window.first.second >= binEnd)
+            numTrialsInBin += window.second;
+    }
+
+    return numTrialsInBin;
+}
+
+DynamicObject PSTHAccumulator::getInfo()
+{
+    DynamicObject info;
+
+    info.setProperty(Identifier("electrode"),
+        var(spikeChannel->getName()));
+    info.setProperty(Identifier("condition"),
+        var(source->name));
+    info.setProperty(Identifier("color"),
+        var(source->colour.toString()));
+    info.setProperty(Identifier("trial_count"),
+        var(getNumTrials()));
+    info.setProperty(Identifier("trial_count_limited_by_spikes"),
+        var(isLimitedBySpikes()));
+    info.setProperty(Identifier("max_trial_jitter_ms"),
+        var(getMaxTrialJitterMs()));
+
+    Array<var> bin_edges;
+    Array<var> spike_counts;
+    Array<var> trial_counts;
+
+    for (int bin = 0; bin < getNumBins(); bin++)
+    {
+        bin_edges.add(binEdges[bin]);
+        spike_counts.add(getCount(0, bin));
+        trial_counts.add(getNumTrialsInBin(bin));
+    }
+
+    info.setProperty(Identifier("bin_edges"), bin_edges);
+    info.setProperty(Identifier("spike_counts"), spike_counts);
+    info.setProperty(Identifier("trial_counts"), trial_counts);
+
+    return info;
+}
+
+
+PSTHEngine::PSTHEngine(SpikeEventQueue* queue_)
+    : queue(queue_),
+      records(4096)
+{
+
+}
+
+void PSTHEngine::prepareToUpdate()
+{
+    // nothing is freed until finishUpdate, so a histogram can never
+    // be matched to a new accumulator at the address of an old one
+    for (int i = accumulators.size(); --i >= 0;)
+        previousAccumulators.emplace(accumulatorKeys[i], std::unique_ptr<PSTHAccumulator>(accumulators.removeAndReturn(i)));
+
+    for (int i = channelIndices.size(); --i >= 0;)
+        previousChannelIndices.emplace(channelKeys[i], std::unique_ptr<ChannelIndices>(channelIndices.removeAndReturn(i)));
+
+    accumulatorKeys.clear();
+    channelKeys.clear();
+    channels.clear();
+    spikeRoutes.clear();
+    eventRoutes.clear();
+    streamSlots.clear();
+    streamSampleRates.clear();
+    previousBlockEnds.clear();
+    pendingTrials.clear();
+}
+
+int PSTHEngine::addStreamSlot(uint16 streamId, double sampleRate)
+{
+    if (streamId >= streamSlots.size())
+        streamSlots.resize(streamId + 1, -1);
+
+    if (streamSlots[streamId] < 0)
+    {
+        streamSlots[streamId] = (int) streamSampleRates.size();
+        streamSampleRates.push_back(sampleRate);
+        previousBlockEnds.push_back(-1);
+        pendingTrials.emplace_back();
+
+        for (auto& sourceRoutes : eventRoutes)
+            sourceRoutes.resize(streamSampleRates.size());
+    }
+
+    return streamSlots[streamId];
+}
+
+PSTHAccumulator* PSTHEngine::addAccumulator(const SpikeChannel* channel, int channelIndex,
+                                            const TriggerSource* source, int sourceIndex)
+{
+    jassert(channelIndex >= 0 && sourceIndex >= 0);
+
+    if (channelIndex >= (int) spikeRoutes.size())
+    {
+        spikeRoutes.resize(channelIndex + 1);
+        channels.resize(channelIndex + 1, nullptr);
+    }
+
+    // channel objects are recreated with every signal chain update,
+    // so channels are identified by their stream and name instead
+    const String channelKey = String(channel->getStreamId()) + ":" + channel->getName();
+
+    ChannelIndices*& indices = channels[channelIndex];
+
+    if (indices == nullptr)
+        indices = addChannelIndices(channelKey, channel->getSampleRate());
+
+    const String key = channelKey + ":" + String(source->id);
+
+    PSTHAccumulator* accumulator = nullptr;
+
+    auto previous = previousAccumulators.find(key);
+
+    if (previous != previousAccumulators.end()
+        && previous->second->getSampleRate() == indices->sampleRate)
+    {
+        accumulator = previous->second.release();
+        previousAccumulators.erase(previous);
+
+        accumulator->spikeChannel = channel;
+        accumulator->source = source;
+    }
+    else
+    {
+        accumulator = new PSTHAccumulator(channel, source, &indices->units, &indices->spikes, &binMaps);
+        accumulator->setBinSizeMs(bin_size_ms);
+        accumulator->setWindowSizeMs(pre_ms, post_ms);
+        accumulator->setMaxTrials(maxTrials);
+        accumulator->setRecencyHalfLife(recencyHalfLife);
+    }
+
+    accumulators.add(accumulator);
+    accumulatorKeys.add(key);
+
+    const int streamSlot = addStreamSlot(accumulator->streamId, accumulator->getSampleRate());
+
+    if (sourceIndex >= (int) eventRoutes.size())
+        eventRoutes.resize(sourceIndex + 1, std::vector<Array<PSTHAccumulator*>>(streamSampleRates.size()));
+
+    eventRoutes[sourceIndex][streamSlot].add(accumulator);
+    spikeRoutes[channelIndex].add(accumulator);
+
+    return accumulator;
+}
+
+PSTHEngine::ChannelIndices* PSTHEngine::addChannelIndices(const String& channelKey, double sampleRate)
+{
+    ChannelIndices* indices = nullptr;
+
+    auto previous = previousChannelIndices.find(channelKey);
+
+    if (previous != previousChannelIndices.end() && previous->second->sampleRate == sampleRate)
+    {
+        indices = previous->second.release();
+        previousChannelIndices.erase(previous);
+    }
+    else
+    {
+        indices = new ChannelIndices(sampleRate);
+    }
+
+    channelIndices.add(indices);
+    channelKeys.add(channelKey);
+
+    updateSpikeRetention();
+
+    return indices;
+}
+
+void PSTHEngine::finishUpdate()
+{
+    previousAccumulators.clear();
+    previousChannelIndices.clear();
+
+    updateStoredSpikeBudget();
+}
+
+void PSTHEngine::updateStoredSpikeBudget()
+{
+    // only the minimum share can take the total past the budget,
+    // which needs more than 4096 accumulators
+    const int maxSpikes = jmax(minStoredSpikesPerAccumulator,
+                               storedSpikeBudget / jmax(1, accumulators.size()));
+
+    for (auto accumulator : accumulators)
+        accumulator->setMaxStoredSpikes(maxSpikes);
+}
+
+Array<PSTHAccumulator*> PSTHEngine::getAccumulators()
+{
+    Array<PSTHAccumulator*> result;
+
+    for (auto accumulator : accumulators)
+        result.add(accumulator);
+
+    return result;
+}
+
+void PSTHEngine::setWindowSizeMs(int pre_ms_, int post_ms_)
+{
+    pre_ms = pre_ms_;
+    post_ms = post_ms_;
+
+    updateSpikeRetention();
+
+    for (auto accumulator : accumulators)
+        accumulator->setWindowSizeMs(pre_ms, post_ms);
+}
+
+void PSTHEngine::setSpikeRetentionMs(int retentionMs)
+{
+    spikeRetentionMs = retentionMs;
+
+    updateSpikeRetention();
+}
+
+void PSTHEngine::updateSpikeRetention()
+{
+    // every trial needs its whole window, plus some slack
+    // for the clock records that close it
+    const int retentionMs = jmax(spikeRetentionMs, pre_ms + post_ms + 1000);
+
+    for (auto indices : channelIndices)
+        indices->spikes.setRetentionMs(retentionMs);
+}
+
+int64 PSTHEngine::getNumDroppedSpikes() const
+{
+    int64 numDropped = 0;
+
+    for (auto indices : channelIndices)
+        numDropped += indices->spikes.getNumDropped();
+
+    return numDropped;
+}
+
+void PSTHEngine::setBinSizeMs(float bin_size)
+{
+    bin_size_ms = bin_size;
+
+    for (auto accumulator : accumulators)
+        accumulator->setBinSizeMs(bin_size_ms);
+}
+
+void PSTHEngine::setMaxTrials(int maxTrials_)
+{
+    maxTrials = maxTrials_;
+
+    for (auto accumulator : accumulators)
+        accumulator->setMaxTrials(maxTrials);
+}
+
+void PSTHEngine::setRecencyHalfLife(float halfLife)
+{
+    recencyHalfLife = halfLife;
+
+    for (auto accumulator : accumulators)
+        accumulator->setRecencyHalfLife(recencyHalfLife);
+}
+
+void PSTHEngine::start()
+{
+    // sample numbers restart with each acquisition, so
+    // trials left open by the previous run are discarded
+    for (auto& trialQueue : pendingTrials)
+        trialQueue = TrialQueue();
+
+    std::fill(previousBlockEnds.begin(), previousBlockEnds.end(), -1);
+
+    for (auto indices : channelIndices)
+        indices->spikes.clear();
+
+    numExpiredTrials = 0;
+
+    startTimer(20);
+}
+
+void PSTHEngine::stop()
+{
+    stopTimer();
+
+    drain();
+}
+
+void PSTHEngine::timerCallback()
+{
+    drain();
+}
+
+void PSTHEngine::drain()
+{
+    int numRecords;
+
+    do
+    {
+        numRecords = queue->pop(records.data(), (int) records.size());
+
+        for (int i = 0; i < numRecords; i++)
+        {
+            const PSTHRecord& record = records[i];
+
+            if (record.type == PSTHRecord::SPIKE)
+                pushSpike(record.index, record.sampleNumber, record.sortedId);
+            else if (record.type == PSTHRecord::EVENT)
+                pushEvent(record.index, record.streamId, record.sampleNumber, record.jitter);
+            else
+                advanceClock(record.streamId, record.sampleNumber);
+        }
+
+    } while (numRecords == (int) records.size());
+}
+
+void PSTHEngine::pushEvent(int sourceIndex, uint16 streamId, int64 sample_number, int jitter)
+{
+    const int streamSlot = getStreamSlot(streamId);
+
+    if (streamSlot < 0 || sourceIndex < 0 || sourceIndex >= (int) eventRoutes.size())
+        return;
+
+    if (eventRoutes[sourceIndex][streamSlot].isEmpty())
+        return;
+
+    pendingTrials[streamSlot].push({ sample_number, jitter, sourceIndex });
+}
+
+void PSTHEngine::pushSpike(int channelIndex, int64 sample_number, int sortedId)
+{
+    if (channelIndex < 0 || channelIndex >= (int) spikeRoutes.size())
+        return;
+
+    ChannelIndices* indices = channels[channelIndex];
+
+    if (indices == nullptr)
+        return;
+
+    const int numUnits = indices->units.getNumUnits();
+    const int unitSlot = indices->units.getSlot(sortedId);
+
+    indices->spikes.add(sample_number, unitSlot);
+
+    // the accumulators only need to hear about the spike if it is from a new unit
+    if (indices->units.getNumUnits() > numUnits)
+    {
+        for (auto accumulator : spikeRoutes[channelIndex])
+            accumulator->addUnits();
+    }
+}
+
+void PSTHEngine::advanceClock(uint16 streamId, int64 sample_number)
+{
+    const int streamSlot = getStreamSlot(streamId);
+
+    if (streamSlot < 0)
+        return;
+
+    TrialQueue& trialQueue = pendingTrials[streamSlot];
+
+    const int64 postSamples = int64(post_ms * streamSampleRates[streamSlot] / 1000);
+
+    // spikes whose waveform crosses the end of a block are sent with the
+    // next one, so a window is only closed once the block after the one
+    // it ended in has arrived
+    const int64 deadline = previousBlockEnds[streamSlot];
+
+    previousBlockEnds[streamSlot] = sample_number;
+
+    while (!trialQueue.empty() && trialQueue.top().sampleNumber + postSamples < deadline)
+    {
+        const PendingTrial trial = trialQueue.top();
+        trialQueue.pop();
+
+        for (auto accumulator : eventRoutes[trial.sourceIndex][streamSlot])
+        {
+            if (!accumulator->addTrial(trial.sampleNumber, trial.jitter))
+                numExpiredTrials++;
+        }
+    }
+}
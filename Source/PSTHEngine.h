@@ -0,0 +1,515 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef PSTHENGINE_H_
+#define PSTHENGINE_H_
+
+#include <ProcessorHeaders.h>
+
+#include "BaseCounts.h"
+#include "BinMapCache.h"
+#include "RecencyCounts.h"
+#include "SpikeEventQueue.h"
+#include "SpikeIndex.h"
+#include "TrialStore.h"
+#include "UnitIndex.h"
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <queue>
+#include <vector>
+
+class TriggerSource;
+
+/**
+
+    Accumulates the PSTH for one spike channel and one trigger source.
+
+    Holds all of the binning state, independent of any GUI component,
+    so trials are collected whether or not the canvas is open.
+
+*/
+class PSTHAccumulator
+{
+public:
+
+    /** Constructor */
+    PSTHAccumulator(const SpikeChannel* channel, const TriggerSource* source,
+                    UnitIndex* units, SpikeIndex* spikes, BinMapCache* binMaps);
+
+    /** Destructor */
+    ~PSTHAccumulator() { }
+
+    /** Adds bin counts for units that have appeared in the channel's UnitIndex since the last call */
+    void addUnits();
+
+    /** Aligns the spikes around an event whose window has closed and adds them
+        as a new trial; jitter is the uncertainty of the event's sample number.
+        Returns false if the window reaches back past the spike index's horizon,
+        in which case the trial is skipped rather than counted incomplete */
+    bool addTrial(int64 event_sample_number, int jitter);
+
+    /** Clears all accumulated trials */
+    void clear();
+
+    /** Sets the window size */
+    void setWindowSizeMs(int pre_ms, int post_ms);
+
+    /** Sets the bin size (rounded to 0.1 ms) */
+    void setBinSizeMs(float ms);
+
+    /** Keeps only the most recent trials (0 = keep all trials) */
+    void setMaxTrials(int maxTrials);
+
+    /** Returns the number of most recent trials kept (0 = all trials) */
+    int getMaxTrials() const { return maxTrials; }
+
+    /** Sets the most trial spikes stored when a trial limit is set */
+    void setMaxStoredSpikes(int maxSpikes);
+
+    /** Returns whether fewer than the most recent maxTrials trials are kept,
+        because they would hold more spikes than this accumulator may store */
+    bool isLimitedBySpikes() const { return limitedBySpikes; }
+
+    /** Sets the half-life of the recency-weighted counts, in trials */
+    void setRecencyHalfLife(float halfLife);
+
+    /** Returns the unit slot of a sorted ID, or -1 if it has not been seen */
+    int getSortedIdIndex(int sortedId) const { return units->findSlot(sortedId); }
+
+    /** Returns all sorted IDs seen so far, in slot order */
+    const Array<int>& getSortedIds() const { return units->getSortedIds(); }
+
+    /** Returns the number of units with bin counts */
+    int getNumUnits() const { return counts.size(); }
+
+    /** Returns the number of bins */
+    int getNumBins() const { return binEdges.size() - 1; }
+
+    /** Returns the sample rate of the spike channel */
+    double getSampleRate() const { return sample_rate; }
+
+    /** Returns the bin edges in ms */
+    const Array<double>& getBinEdges() const { return binEdges; }
+
+    /** Returns the spike count for one unit in one bin */
+    int getCount(int sortedIdIndex, int bin)
+    {
+        return hasBaseBins() ? baseCounts[sortedIdIndex].get(firstBinBaseBin + bin)
+                             : counts.getReference(sortedIdIndex)[bin];
+    }
+
+    /** Returns the largest bin count for one unit */
+    int getMaxCount(int sortedIdIndex) const { return maxCounts[sortedIdIndex]; }
+
+    /** Returns the recency-weighted mean spike count per trial for one unit in one bin */
+    float getRecencyCount(int sortedIdIndex, int bin) { return toRecencyCount(getRecencyValue(sortedIdIndex, bin)); }
+
+    /** Returns the largest recency-weighted count for one unit */
+    float getMaxRecencyCount(int sortedIdIndex) const { return toRecencyCount(maxRecencyCounts[sortedIdIndex]); }
+
+    /** Returns the spikes of all completed trials, aligned to their events */
+    const TrialStore& getTrials() const { return trials; }
+
+    /** Converts a sample offset from the trials to ms */
+    double sampleOffsetToMs(int32 sampleOffset) const { return double(sampleOffset) * 1000.0 / sample_rate; }
+
+    /** Returns the number of trials included in the counts */
+    int getNumTrials() const { return numTrials - firstTrial; }
+
+    /** Returns the number of included trials whose window covered a whole bin; trials
+        closed before the window was widened have no spikes outside their own window */
+    int getNumTrialsInBin(int bin) const;
+
+    /** Returns whether every included trial covered every bin */
+    bool allTrialsCoverWindow() const { return getNumTrialsInBin(0) == getNumTrials() && getNumTrialsInBin(getNumBins() - 1) == getNumTrials(); }
+
+    /** Returns the index of the oldest trial included in the counts */
+    int getFirstTrialIndex() const { return firstTrial; }
+
+    /** Returns the largest timing uncertainty of any trial completed since the last clear, in ms */
+    double getMaxTrialJitterMs() const { return sampleOffsetToMs(maxTrialJitter); }
+
+    /** Returns the pre-event window size */
+    int getPreWindowSizeMs() const { return pre_ms; }
+
+    /** Returns the post-event window size */
+    int getPostWindowSizeMs() const { return post_ms; }
+
+    /** Returns the bin size in use, which is the requested size
+        rounded to whole ms when the base range is too long for 0.1 ms */
+    float getBinSizeMs() const { return binWidthMs; }
+
+    /** Incremented whenever the counts change */
+    int64 getVersion() const { return version; }
+
+    /** Return info about this PSTH */
+    DynamicObject getInfo();
+
+    /** Stream ID for this PSTH */
+    const uint16 streamId;
+
+    /** Spike channel for this PSTH */
+    const SpikeChannel* spikeChannel;
+
+    /** Trigger source for this PSTH */
+    const TriggerSource* source;
+
+private:
+
+    /** Recomputes the bin counts by summing the base counts */
+    void rebin();
+
+    /** Adds one spike to the base and bin counts */
+    void addToCounts(int unitSlot, int baseBin);
+
+    /** Decays the recency-weighted counts at the start of a trial */
+    void decayRecencyCounts();
+
+    /** Returns whether every bin is one base bin, so the bin counts are read from the base counts */
+    bool hasBaseBins() const { return firstBinBaseBin >= 0; }
+
+    /** Returns the stored recency value of one unit in one bin */
+    float getRecencyValue(int sortedIdIndex, int bin)
+    {
+        return hasBaseBins() ? recencyBase[sortedIdIndex].get(firstBinBaseBin + bin)
+                             : recencyCounts.getReference(sortedIdIndex)[bin];
+    }
+
+    /** Converts a stored recency value to a mean count per trial */
+    float toRecencyCount(float value) const { return recencyWeight > 0 ? float(value * recencyScale / recencyWeight) : 0.0f; }
+
+    /** Removes the oldest trials until the trial and spike limits are met */
+    void evictTrials();
+
+    /** Removes the spikes of the oldest trial from the base and bin counts */
+    void removeOldestTrial();
+
+    /** Recomputes the base counts from the stored trials, after the base resolution changes */
+    void rebuildBaseCounts();
+
+    /** Widens the range covered by the base counts to include the current window */
+    void extendBaseRange();
+
+    /** Narrows the range covered by the base counts to the current window */
+    void shrinkBaseRange();
+
+    /** Returns the finest base resolution allowed for the current base range */
+    int getMaxBaseBinsPerMs() const { return (basePreMs + basePostMs <= maxFineBaseRangeMs) ? 10 : 1; }
+
+    /** Returns the number of base bins covering the base range */
+    int getNumBaseBins() const { return (basePreMs + basePostMs) * baseBinsPerMs; }
+
+    /** Returns the base bin width in samples, inverted */
+    double getBaseBinsPerSample() const { return baseBinsPerMs * 1000.0 / sample_rate; }
+
+    typedef std::pair<int, int> WindowSize;
+
+    /** Runs of consecutive included trials closed with the same window (pre_ms, post_ms),
+        oldest first, and the number of included trials closed with each window */
+    std::deque<std::pair<WindowSize, int>> trialWindowRuns;
+    std::map<WindowSize, int> trialWindowCounts;
+
+    /** Largest timing uncertainty of any trial's event since the last clear, in samples */
+    int32 maxTrialJitter = 0;
+
+    UnitIndex* units;
+
+    /** Recent spikes of the channel, shared with its other accumulators */
+    SpikeIndex* spikes;
+
+    Array<double> binEdges;
+
+    TrialStore trials;
+
+    /** Spike counts per unit in base bins, covering [-basePreMs, basePostMs) */
+    std::vector<BaseCounts> baseCounts;
+
+    /** Range covered by the base counts: the largest window used since the last clear,
+        or since a sub-ms bin size last needed a shorter range */
+    int basePreMs = 0;
+    int basePostMs = 0;
+
+    /** Base bins per ms: 1, or 10 for sub-ms bin sizes */
+    int baseBinsPerMs = 1;
+
+    /** Longest base range counted at 0.1 ms; longer ranges use a 1 ms base,
+        so no base row ever has more than 20000 bins */
+    static const int maxFineBaseRangeMs = 2000;
+
+    /** Maps shared with the other accumulators of the engine */
+    BinMapCache* binMaps;
+
+    /** Bin for each base bin, or -1 if it is outside the window */
+    BinMapCache::BinMap baseToBin;
+
+    /** Base bins of the spikes being added to a trial */
+    std::vector<int> baseBinScratch;
+
+    /** Base bin of the first bin when every bin is one base bin, or -1 */
+    int firstBinBaseBin = -1;
+
+    /** Spike counts per unit in bins; empty when every bin is one base bin */
+    Array<Array<int>> counts;
+    Array<int> maxCounts;
+
+    /** Exponentially weighted counts per unit in base bins, and summed into bins
+        unless every bin is one base bin; all values are relative to recencyScale */
+    std::vector<RecencyCounts> recencyBase;
+    Array<Array<float>> recencyCounts;
+    Array<float> maxRecencyCounts;
+
+    /** Per-trial decay factor, and the product of all decays since the values were last rescaled */
+    double recencyDecay;
+    double recencyScale = 1.0;
+
+    /** Total weight of all trials, which normalizes the counts while few trials have been seen */
+    double recencyWeight = 0.0;
+
+    /** Stored weight of one spike in the current trial */
+    float recencyIncrement = 0.0f;
+
+    int pre_ms;
+    int post_ms;
+    float bin_size_ms;
+
+    /** Width of the bins in use */
+    float binWidthMs;
+
+    /** Trials completed since the last clear; trials before firstTrial have been evicted */
+    int numTrials = 0;
+    int firstTrial = 0;
+
+    /** Number of most recent trials to keep, or 0 to keep all of them */
+    int maxTrials = 0;
+
+    /** Whether the last eviction removed trials to stay within maxStoredSpikes */
+    bool limitedBySpikes = false;
+
+    int64 version = 0;
+
+    const double sample_rate;
+
+    /** The recency values are rescaled before the decay scale falls below this */
+    static constexpr double minRecencyScale = 1e-20;
+
+    /** Upper bound on the trial spikes stored when a trial limit is set,
+        this accumulator's share of the engine's budget */
+    int maxStoredSpikes = 1 << 20;
+
+    JUCE_DECLARE_NON_COPYABLE(PSTHAccumulator);
+};
+
+
+/**
+
+    Owns the PSTH accumulators and feeds them with the spikes and
+    events queued by the processor. Trial windows are closed on each
+    stream's sample clock, which advances with every processed block.
+
+    Runs on the message thread, whether or not the canvas is open.
+    When the window or bin size changes, the accumulators are rebinned
+    in place; rebinning sums the base counts, so it costs time in
+    proportion to the bins, not to the trials.
+
+*/
+class PSTHEngine : public Timer
+{
+public:
+
+    /** Constructor */
+    PSTHEngine(SpikeEventQueue* queue);
+
+    /** Destructor */
+    ~PSTHEngine() { }
+
+    /** Sets aside all accumulators and clears the routing, before the
+        accumulators for the new signal chain are added */
+    void prepareToUpdate();
+
+    /** Adds an accumulator for a spike channel / trigger source pair, and routes
+        records with the given channel and source indices to it. If the previous
+        signal chain had an accumulator for the same stream, channel name and
+        trigger source, it is reused with all of its trials */
+    PSTHAccumulator* addAccumulator(const SpikeChannel* channel, int channelIndex,
+                                    const TriggerSource* source, int sourceIndex);
+
+    /** Frees the accumulators that were not reused */
+    void finishUpdate();
+
+    /** Returns all accumulators */
+    Array<PSTHAccumulator*> getAccumulators();
+
+    /** Sets the window size of all accumulators, and rebins them */
+    void setWindowSizeMs(int pre_ms, int post_ms);
+
+    /** Sets the bin size of all accumulators, and rebins them */
+    void setBinSizeMs(float bin_size);
+
+    /** Keeps only the most recent trials in all accumulators (0 = keep all trials) */
+    void setMaxTrials(int maxTrials);
+
+    /** Sets the half-life of the recency-weighted counts of all accumulators, in trials */
+    void setRecencyHalfLife(float halfLife);
+
+    /** Sets how long spikes are kept for aligning late triggers, in ms
+        (never less than the window plus one second) */
+    void setSpikeRetentionMs(int retentionMs);
+
+    /** Returns the number of trials skipped since the last start, because
+        their trigger arrived after the spikes had been released */
+    int64 getNumExpiredTrials() const { return numExpiredTrials; }
+
+    /** Returns the number of spikes released early since the last start, because
+        a channel exceeded the spike rate its index keeps */
+    int64 getNumDroppedSpikes() const;
+
+    /** Starts draining the queue */
+    void start();
+
+    /** Drains any remaining records and stops */
+    void stop();
+
+    /** Pops all pending records from the queue and routes them to the accumulators */
+    void drain();
+
+private:
+
+    /** Drains the queue periodically */
+    void timerCallback() override;
+
+    /** Routes an event to all accumulators for a trigger source on one stream */
+    void pushEvent(int sourceIndex, uint16 streamId, int64 sample_number, int jitter);
+
+    /** Adds a spike to its channel's index */
+    void pushSpike(int channelIndex, int64 sample_number, int sortedId);
+
+    /** Advances the sample clock of a stream and closes every trial whose
+        window ended before the previous block, so late spikes are included */
+    void advanceClock(uint16 streamId, int64 sample_number);
+
+    /** Unit and spike indices shared by all accumulators of one spike channel */
+    struct ChannelIndices
+    {
+        ChannelIndices(double sampleRate_) : sampleRate(sampleRate_), spikes(sampleRate_) { }
+
+        const double sampleRate;
+
+        UnitIndex units;
+        SpikeIndex spikes;
+    };
+
+    /** Returns the indices for a channel, reusing those from the previous signal chain if possible */
+    ChannelIndices* addChannelIndices(const String& channelKey, double sampleRate);
+
+    /** Splits the stored spike budget between the accumulators */
+    void updateStoredSpikeBudget();
+
+    /** Applies the retention horizon to every spike index */
+    void updateSpikeRetention();
+
+    /** Returns the routing slot of a stream, adding it if necessary */
+    int addStreamSlot(uint16 streamId, double sampleRate);
+
+    /** Returns the routing slot of a stream, or -1 if it has no accumulators */
+    int getStreamSlot(uint16 streamId) const
+    {
+        return streamId < streamSlots.size() ? streamSlots[streamId] : -1;
+    }
+
+    SpikeEventQueue* queue;
+
+    std::vector<PSTHRecord> records;
+
+    /** Base-to-bin maps, shared by the accumulators with the same layout */
+    BinMapCache binMaps;
+
+    OwnedArray<PSTHAccumulator> accumulators;
+
+    /** Identity of each accumulator: stream, spike channel name and trigger source ID */
+    StringArray accumulatorKeys;
+
+    OwnedArray<ChannelIndices> channelIndices;
+
+    /** Identity of each channel's indices: stream and spike channel name */
+    StringArray channelKeys;
+
+    /** Accumulators and channel indices of the previous signal chain, by identity,
+        until they are reused or freed */
+    std::multimap<String, std::unique_ptr<PSTHAccumulator>> previousAccumulators;
+    std::multimap<String, std::unique_ptr<ChannelIndices>> previousChannelIndices;
+
+    /** Accumulators fed by each spike channel, indexed by channel index */
+    std::vector<Array<PSTHAccumulator*>> spikeRoutes;
+
+    /** Accumulators triggered by each source, indexed by source index, then stream slot */
+    std::vector<std::vector<Array<PSTHAccumulator*>>> eventRoutes;
+
+    /** Stream slot for each stream ID (-1 if unused) */
+    std::vector<int> streamSlots;
+
+    /** Sample rate of each stream slot */
+    std::vector<double> streamSampleRates;
+
+    /** End of the previous block of each stream slot, or -1 before the first block */
+    std::vector<int64> previousBlockEnds;
+
+    struct PendingTrial
+    {
+        int64 sampleNumber;
+        int32 jitter;
+        int sourceIndex;
+
+        bool operator>(const PendingTrial& other) const { return sampleNumber > other.sampleNumber; }
+    };
+
+    typedef std::priority_queue<PendingTrial, std::vector<PendingTrial>, std::greater<PendingTrial>> TrialQueue;
+
+    /** Trials whose window is still open, earliest first, indexed by stream slot.
+        All windows have the same length, so the earliest event closes first. */
+    std::vector<TrialQueue> pendingTrials;
+
+    /** Indices shared by all accumulators of a spike channel, indexed by channel index */
+    std::vector<ChannelIndices*> channels;
+
+    int spikeRetentionMs = 10000;
+
+    int64 numExpiredTrials = 0;
+
+    int pre_ms = 0;
+    int post_ms = 0;
+    float bin_size_ms = 10.0f;
+    int maxTrials = 0;
+    float recencyHalfLife = 20.0f;
+
+    /** Trial spikes stored by all accumulators together when a trial limit
+        is set (about 10 bytes each), and the least any one accumulator gets */
+    static const int storedSpikeBudget = 1 << 24;
+    static const int minStoredSpikesPerAccumulator = 4096;
+
+    JUCE_DECLARE_NON_COPYABLE(PSTHEngine);
+};
+
+
+#endif  // PSTHENGINE_H_
@@ -0,0 +1,94 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "RecencyCounts.h"
+
+RecencyCounts::RecencyCounts(int numBins)
+    : values(numBins, 0.0f)
+{
+
+}
+
+void RecencyCounts::setNumBins(int numBins)
+{
+    values.assign(numBins, 0.0f);
+}
+
+void RecencyCounts::clear()
+{
+    setNumBins(size());
+}
+
+void RecencyCounts::extend(int binsBefore, int binsAfter)
+{
+    values.insert(values.begin(), binsBefore, 0.0f);
+    values.insert(values.end(), binsAfter, 0.0f);
+}
+
+void RecencyCounts::trim(int binsBefore, int binsAfter)
+{
+    values.erase(values.end() - binsAfter, values.end());
+    values.erase(values.begin(), values.begin() + binsBefore);
+}
+
+void RecencyCounts::resample(int oldBinsPerMs, int newBinsPerMs)
+{
+    std::vector<float> resampled;
+
+    if (newBinsPerMs > oldBinsPerMs)
+    {
+        const int factor = newBinsPerMs / oldBinsPerMs;
+
+        resampled.reserve(values.size() * factor);
+
+        for (float value : values)
+            resampled.insert(resampled.end(), factor, value / float(factor));
+    }
+    else
+    {
+        const int factor = oldBinsPerMs / newBinsPerMs;
+
+        resampled.assign(values.size() / factor, 0.0f);
+
+        for (size_t i = 0; i < resampled.size() * factor; i++)
+            resampled[i / factor] += values[i];
+    }
+
+    values.swap(resampled);
+}
+
+void RecencyCounts::scale(float factor)
+{
+    for (float& value : values)
+        value *= factor;
+}
+
+void RecencyCounts::sumInto(const int* binMap, float* sums) const
+{
+    const int numBins = size();
+
+    for (int i = 0; i < numBins; i++)
+    {
+        if (binMap[i] >= 0)
+            sums[binMap[i]] += values[i];
+    }
+}
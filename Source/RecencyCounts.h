@@ -0,0 +1,85 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RECENCYCOUNTS_H_
+#define RECENCYCOUNTS_H_
+
+#include <ProcessorHeaders.h>
+
+#include <vector>
+
+/**
+
+    Exponentially weighted spike counts for one unit at the finest
+    binning resolution.
+
+    Values are stored relative to a decay scale held by the owner,
+    so decaying all bins at the start of a trial only changes that
+    scale; each spike then adds its weight divided by the scale.
+
+*/
+class RecencyCounts
+{
+public:
+
+    /** Constructor */
+    RecencyCounts(int numBins = 0);
+
+    /** Sets the number of bins and clears all values */
+    void setNumBins(int numBins);
+
+    /** Clears all values */
+    void clear();
+
+    /** Adds empty bins before the first and after the last bin */
+    void extend(int binsBefore, int binsAfter);
+
+    /** Removes bins from before the first and after the last bin */
+    void trim(int binsBefore, int binsAfter);
+
+    /** Changes the resolution by a whole factor: values are summed when
+        bins are merged, and split evenly when bins are subdivided */
+    void resample(int oldBinsPerMs, int newBinsPerMs);
+
+    /** Returns the number of bins */
+    int size() const { return (int) values.size(); }
+
+    /** Returns the value in one bin */
+    float get(int bin) const { return values[bin]; }
+
+        /** Adds a weight to a bin */
+    void add(int bin, float weight) { values[bin] += weight; }
+
+    /** Multiplies all values by a factor */
+    void scale(float factor);
+
+    /** Adds each value to sums[binMap[i]], skipping bins mapped to -1 */
+    void sumInto(const int* binMap, float* sums) const;
+
+private:
+
+    std::vector<float> values;
+};
+
+
+#endif  // RECENCYCOUNTS_H_
@@ -0,0 +1,168 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SpikeEventQueue.h"
+
+#include <algorithm>
+
+PSTHBlockBatch::PSTHBlockBatch(int capacity)
+{
+    records.reserve(capacity);
+}
+
+bool PSTHBlockBatch::addSpike(int channelIndex, uint16 streamId, int64 sample_number, int sortedId)
+{
+    PSTHRecord record;
+    record.sampleNumber = sample_number;
+    record.index = channelIndex;
+    record.sortedId = sortedId;
+    record.jitter = 0;
+    record.streamId = streamId;
+    record.type = PSTHRecord::SPIKE;
+
+    return add(record);
+}
+
+bool PSTHBlockBatch::addEvent(int sourceIndex, uint16 streamId, int64 sample_number, int jitter)
+{
+    PSTHRecord record;
+    record.sampleNumber = sample_number;
+    record.index = sourceIndex;
+    record.sortedId = 0;
+    record.jitter = jitter;
+    record.streamId = streamId;
+    record.type = PSTHRecord::EVENT;
+
+    return add(record);
+}
+
+bool PSTHBlockBatch::addClock(uint16 streamId, int64 sample_number)
+{
+    PSTHRecord record;
+    record.sampleNumber = sample_number;
+    record.index = -1;
+    record.sortedId = 0;
+    record.jitter = 0;
+    record.streamId = streamId;
+    record.type = PSTHRecord::CLOCK;
+
+    return add(record);
+}
+
+bool PSTHBlockBatch::add(const PSTHRecord& record)
+{
+    if (isFull())
+        return false;
+
+    records.push_back(record);
+
+    return true;
+}
+
+void PSTHBlockBatch::sort()
+{
+    std::sort(records.begin(), records.end(),
+              [](const PSTHRecord& a, const PSTHRecord& b)
+              {
+                  if (a.streamId != b.streamId)
+                      return a.streamId < b.streamId;
+
+                  if (a.sampleNumber != b.sampleNumber)
+                      return a.sampleNumber < b.sampleNumber;
+
+                  return a.type < b.type;
+              });
+}
+
+SpikeEventQueue::SpikeEventQueue(int capacity)
+    : fifo(capacity),
+      buffer(capacity),
+      numPushed(0),
+      numDropped(0)
+{
+
+}
+
+int SpikeEventQueue::push(const PSTHBlockBatch& batch)
+{
+    const int numRecords = batch.size();
+
+    if (numRecords == 0)
+        return 0;
+
+    int start1, size1, start2, size2;
+
+    fifo.prepareToWrite(numRecords, start1, size1, start2, size2);
+
+    const PSTHRecord* records = batch.data();
+
+    for (int i = 0; i < size1; i++)
+        buffer[start1 + i] = records[i];
+
+    for (int i = 0; i < size2; i++)
+        buffer[start2 + i] = records[size1 + i];
+
+    const int numWritten = size1 + size2;
+
+    fifo.finishedWrite(numWritten);
+
+    numPushed.fetch_add(numWritten, std::memory_order_relaxed);
+
+    if (numWritten < numRecords)
+        numDropped.fetch_add(numRecords - numWritten, std::memory_order_relaxed);
+
+    return numWritten;
+}
+
+int SpikeEventQueue::pop(PSTHRecord* dest, int maxRecords)
+{
+    int start1, size1, start2, size2;
+
+    fifo.prepareToRead(maxRecords, start1, size1, start2, size2);
+
+    for (int i = 0; i < size1; i++)
+        dest[i] = buffer[start1 + i];
+
+    for (int i = 0; i < size2; i++)
+        dest[size1 + i] = buffer[start2 + i];
+
+    fifo.finishedRead(size1 + size2);
+
+    return size1 + size2;
+}
+
+int64 SpikeEventQueue::getNumPushed() const
+{
+    return numPushed.load(std::memory_order_relaxed);
+}
+
+int64 SpikeEventQueue::getNumDropped() const
+{
+    return numDropped.load(std::memory_order_relaxed);
+}
+
+void SpikeEventQueue::reset()
+{
+    fifo.reset();
+    numPushed = 0;
+    numDropped = 0;
+}
@@ -0,0 +1,157 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SPIKEEVENTQUEUE_H_
+#define SPIKEEVENTQUEUE_H_
+
+#include <ProcessorHeaders.h>
+
+#include <atomic>
+#include <vector>
+
+/**
+
+    Compact record of a spike, a trigger event, or the end of a
+    block, passed from the processing thread to the message thread
+
+*/
+struct PSTHRecord
+{
+    enum Type : uint8
+    {
+        SPIKE = 0,
+        EVENT = 1,
+        CLOCK = 2
+    };
+
+    int64 sampleNumber;
+    int32 index;        // spike channel index (SPIKE) or trigger source index (EVENT)
+    int32 sortedId;
+    int32 jitter;       // timing uncertainty of an EVENT, in samples
+    uint16 streamId;
+    Type type;
+};
+
+/**
+
+    Records collected during one call to process(), sorted by stream
+    and sample number before being handed to the queue in one write.
+
+    Storage is reserved up front; adding to a full batch fails, and the
+    caller is expected to flush it first.
+
+*/
+class PSTHBlockBatch
+{
+public:
+
+    /** Constructor */
+    PSTHBlockBatch(int capacity = 16384);
+
+    /** Destructor */
+    ~PSTHBlockBatch() { }
+
+    /** Adds a spike record */
+    bool addSpike(int channelIndex, uint16 streamId, int64 sample_number, int sortedId);
+
+    /** Adds a trigger event record, with the uncertainty of its sample number */
+    bool addEvent(int sourceIndex, uint16 streamId, int64 sample_number, int jitter = 0);
+
+    /** Adds a record marking the end of a block on one stream */
+    bool addClock(uint16 streamId, int64 sample_number);
+
+    /** Orders the records by stream, then sample number; the clock record of a
+        stream sorts after the spikes and events at the same sample number */
+    void sort();
+
+    /** Removes all records */
+    void clear() { records.clear(); }
+
+    /** Returns true if no more records can be added */
+    bool isFull() const { return records.size() == records.capacity(); }
+
+    /** Returns the number of records */
+    int size() const { return (int) records.size(); }
+
+    /** Returns a pointer to the first record */
+    const PSTHRecord* data() const { return records.data(); }
+
+private:
+
+    /** Appends one record if there is room */
+    bool add(const PSTHRecord& record);
+
+    std::vector<PSTHRecord> records;
+
+    JUCE_DECLARE_NON_COPYABLE(PSTHBlockBatch);
+};
+
+/**
+
+    Lock-free single-producer / single-consumer queue of PSTHRecords.
+
+    The processing thread is the only producer; the message thread is
+    the only consumer. All storage is allocated up front, so pushing
+    never allocates or blocks. When the queue is full, new records are
+    dropped and counted.
+
+*/
+class SpikeEventQueue
+{
+public:
+
+    /** Constructor */
+    SpikeEventQueue(int capacity = 65536);
+
+    /** Destructor */
+    ~SpikeEventQueue() { }
+
+    /** Writes all records of a batch at once, dropping any that do not fit,
+        and returns the number written (processing thread only) */
+    int push(const PSTHBlockBatch& batch);
+
+    /** Copies up to maxRecords into dest and returns the number copied (message thread only) */
+    int pop(PSTHRecord* dest, int maxRecords);
+
+    /** Returns the number of records accepted since the last reset */
+    int64 getNumPushed() const;
+
+    /** Returns the number of records dropped because the queue was full */
+    int64 getNumDropped() const;
+
+    /** Discards all pending records and clears the counters (only while the producer is idle) */
+    void reset();
+
+private:
+
+    AbstractFifo fifo;
+    std::vector<PSTHRecord> buffer;
+
+    std::atomic<int64> numPushed;
+    std::atomic<int64> numDropped;
+
+    JUCE_DECLARE_NON_COPYABLE(SpikeEventQueue);
+};
+
+
+#endif  // SPIKEEVENTQUEUE_H_
@@ -0,0 +1,144 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SpikeIndex.h"
+
+#include <limits>
+
+SpikeIndex::SpikeIndex(double sampleRate_)
+    : sampleRate(sampleRate_),
+      horizon(std::numeric_limits<int64>::min())
+{
+
+}
+
+void SpikeIndex::setRetentionMs(int retentionMs)
+{
+    retention = int64(double(retentionMs) * sampleRate / 1000.0);
+
+    maxSpikes = jmax(segmentSize, int(int64(retentionMs) * maxSpikeRateHz / 1000));
+}
+
+void SpikeIndex::clear()
+{
+    while (segments.size() > 0)
+        spare.reset(segments.removeAndReturn(segments.size() - 1));
+
+    numSpikes = 0;
+    numDropped = 0;
+    horizon = std::numeric_limits<int64>::min();
+}
+
+void SpikeIndex::add(int64 sample_number, int unitSlot)
+{
+    if (numSpikes == segments.size() * segmentSize)
+        segments.add(spare != nullptr ? spare.release() : new Segment());
+
+    int i = numSpikes++;
+
+    // spikes arrive almost in order, so a late one
+    // only has to move past a few of its neighbours
+    while (i > 0 && getSampleNumber(i - 1) > sample_number)
+    {
+        Segment* to = segments.getUnchecked(i >> segmentShift);
+        const Segment* from = segments.getUnchecked((i - 1) >> segmentShift);
+
+        to->sampleNumbers[i & segmentMask] = from->sampleNumbers[(i - 1) & segmentMask];
+        to->unitSlots[i & segmentMask] = from->unitSlots[(i - 1) & segmentMask];
+
+        i--;
+    }
+
+    Segment* segment = segments.getUnchecked(i >> segmentShift);
+
+    segment->sampleNumbers[i & segmentMask] = sample_number;
+    segment->unitSlots[i & segmentMask] = unitSlot;
+
+    const int64 newest = getSampleNumber(numSpikes - 1);
+
+    while (segments.size() > 1 && segments.getUnchecked(0)->sampleNumbers[segmentMask] < newest - retention)
+        removeOldestSegment();
+
+    while (numSpikes - segmentSize >= maxSpikes)
+    {
+        removeOldestSegment();
+        numDropped += segmentSize;
+    }
+}
+
+void SpikeIndex::removeOldestSegment()
+{
+    Segment* oldest = segments.removeAndReturn(0);
+
+    horizon = oldest->sampleNumbers[segmentMask] + 1;
+
+    spare.reset(oldest);
+
+    numSpikes -= segmentSize;
+}
+
+int SpikeIndex::getRun(int i, int maxCount, const int64*& runSampleNumbers, const int*& runUnitSlots) const
+{
+    const Segment* segment = segments.getUnchecked(i >> segmentShift);
+    const int start = i & segmentMask;
+
+    runSampleNumbers = segment->sampleNumbers + start;
+    runUnitSlots = segment->unitSlots + start;
+
+    return jmin(maxCount, numSpikes - i, segmentSize - start);
+}
+
+int SpikeIndex::findFirst(int64 sample_number) const
+{
+    if (numSpikes == 0)
+        return 0;
+
+    // find the last segment starting before sample_number,
+    // then search within it
+    int lo = 0;
+    int hi = segments.size();
+
+    while (hi - lo > 1)
+    {
+        const int mid = (lo + hi) / 2;
+
+        if (segments.getUnchecked(mid)->sampleNumbers[0] < sample_number)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    int first = lo << segmentShift;
+    int last = jmin(numSpikes, first + segmentSize);
+
+    while (first < last)
+    {
+        const int mid = (first + last) / 2;
+
+        if (getSampleNumber(mid) < sample_number)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+
+    return first;
+}
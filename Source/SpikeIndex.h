@@ -0,0 +1,119 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SPIKEINDEX_H_
+#define SPIKEINDEX_H_
+
+#include <ProcessorHeaders.h>
+
+/**
+
+    Time-sorted index of recent spikes for one channel, shared by
+    all of the channel's PSTHs.
+
+    Spikes are stored in fixed-size segments, which are searched by
+    sample number, so the spikes around any trigger can be found in
+    O(log n + k), however late the trigger arrives. Whole segments
+    are released once they fall outside the retention horizon, or
+    when the number of stored spikes reaches its limit.
+
+*/
+class SpikeIndex
+{
+public:
+
+    /** Constructor */
+    SpikeIndex(double sampleRate);
+
+    /** Destructor */
+    ~SpikeIndex() { }
+
+    /** Sets how long spikes are kept, in ms */
+    void setRetentionMs(int retentionMs);
+
+    /** Adds a spike; spikes that arrive out of order are moved into place */
+    void add(int64 sample_number, int unitSlot);
+
+    /** Removes all spikes */
+    void clear();
+
+    /** Returns the number of stored spikes */
+    int size() const { return numSpikes; }
+
+    /** Returns the sample number of the i-th stored spike (0 = oldest) */
+    int64 getSampleNumber(int i) const { return segments.getUnchecked(i >> segmentShift)->sampleNumbers[i & segmentMask]; }
+
+    /** Returns the unit slot of the i-th stored spike (0 = oldest) */
+    int getUnitSlot(int i) const { return segments.getUnchecked(i >> segmentShift)->unitSlots[i & segmentMask]; }
+
+    /** Points to the stored spikes from index i onwards that are contiguous in
+        memory, and returns how many there are (at most maxCount) */
+    int getRun(int i, int maxCount, const int64*& runSampleNumbers, const int*& runUnitSlots) const;
+
+    /** Returns the index of the first spike at or after sample_number */
+    int findFirst(int64 sample_number) const;
+
+    /** Returns the earliest sample number for which no spikes have been released */
+    int64 getHorizon() const { return horizon; }
+
+    /** Returns the number of spikes released before they aged out, since the last clear */
+    int64 getNumDropped() const { return numDropped; }
+
+private:
+
+    static const int segmentShift = 10;
+    static const int segmentSize = 1 << segmentShift;
+    static const int segmentMask = segmentSize - 1;
+
+    struct Segment
+    {
+        int64 sampleNumbers[segmentSize];
+        int unitSlots[segmentSize];
+    };
+
+    /** Releases the oldest segment, which is always full */
+    void removeOldestSegment();
+
+    OwnedArray<Segment> segments;
+
+    /** The most recently released segment, reused for the next one needed */
+    std::unique_ptr<Segment> spare;
+
+    int numSpikes = 0;
+
+    const double sampleRate;
+
+    int64 retention = 0;
+    int maxSpikes = segmentSize;
+
+    int64 horizon;
+    int64 numDropped = 0;
+
+    /** Upper bound on the sustained spike rate kept in the index */
+    static const int maxSpikeRateHz = 1000;
+
+    JUCE_DECLARE_NON_COPYABLE(SpikeIndex);
+};
+
+
+#endif  // SPIKEINDEX_H_
@@ -50,8 +50,12 @@ void Timescale::paint(Graphics& g)
         stepSize = 100.0f;
     else if (window_size_ms >= 1000.0f && window_size_ms < 2000.0f)
         stepSize = 250.0f;
-    else
+    else if (window_size_ms >= 2000.0f && window_size_ms < 5000.0f)
         stepSize = 500.0f;
+    else if (window_size_ms >= 5000.0f && window_size_ms < 10000.0f)
+        stepSize = 1000.0f;
+    else
+        stepSize = 2500.0f;
     
     float tickDistance = (stepSize / window_size_ms) * histogramWidth;
     
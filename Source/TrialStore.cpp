@@ -0,0 +1,88 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TrialStore.h"
+
+TrialStore::TrialStore()
+{
+
+}
+
+void TrialStore::add(int32 sampleOffset, int unitSlot, int trialIndex)
+{
+    jassert(unitSlot >= 0 && unitSlot <= 0xFFFF);
+
+    const int chunk = (start + numEntries) >> chunkShift;
+
+    if (chunk == chunks.size())
+        chunks.add(new Chunk());
+
+    const int i = (start + numEntries) & chunkMask;
+
+    chunks.getUnchecked(chunk)->sampleOffsets[i] = sampleOffset;
+    chunks.getUnchecked(chunk)->trialIndices[i] = trialIndex;
+    chunks.getUnchecked(chunk)->unitSlots[i] = (uint16) unitSlot;
+
+    numEntries++;
+}
+
+void TrialStore::clear()
+{
+    chunks.clear();
+
+    start = 0;
+    numEntries = 0;
+}
+
+void TrialStore::removeTrialsBefore(int trialIndex)
+{
+    const int numRemoved = findFirstOfTrial(trialIndex);
+
+    start += numRemoved;
+    numEntries -= numRemoved;
+
+    const int numEmptyChunks = start >> chunkShift;
+
+    if (numEmptyChunks > 0)
+    {
+        chunks.removeRange(0, numEmptyChunks);
+        start &= chunkMask;
+    }
+}
+
+int TrialStore::findFirstOfTrial(int trialIndex) const
+{
+    int lo = 0;
+    int hi = numEntries;
+
+    while (lo < hi)
+    {
+        const int mid = (lo + hi) / 2;
+
+        if (getTrialIndex(mid) < trialIndex)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
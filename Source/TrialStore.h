@@ -0,0 +1,98 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef TRIALSTORE_H_
+#define TRIALSTORE_H_
+
+#include <ProcessorHeaders.h>
+
+/**
+
+    Spikes aligned to completed trials, stored as parallel arrays of
+    sample offsets from the trigger, unit slots and trial indices.
+
+    Storage is allocated in fixed-size chunks, so adding spikes never
+    moves the ones already stored. Entries are kept in trial order,
+    and the oldest trials can be removed from the front; chunks are
+    released as soon as they no longer hold any spikes.
+
+*/
+class TrialStore
+{
+public:
+
+    /** Constructor */
+    TrialStore();
+
+    /** Destructor */
+    ~TrialStore() { }
+
+    /** Adds a spike to a trial (trial indices are expected in increasing order) */
+    void add(int32 sampleOffset, int unitSlot, int trialIndex);
+
+    /** Removes all spikes and releases their storage */
+    void clear();
+
+    /** Removes the spikes of all trials before trialIndex */
+    void removeTrialsBefore(int trialIndex);
+
+    /** Returns the number of stored spikes */
+    int size() const { return numEntries; }
+
+    /** Returns the offset of the i-th spike from its trigger, in samples */
+    int32 getSampleOffset(int i) const { return chunks.getUnchecked((i + start) >> chunkShift)->sampleOffsets[(i + start) & chunkMask]; }
+
+    /** Returns the unit slot of the i-th spike */
+    int getUnitSlot(int i) const { return chunks.getUnchecked((i + start) >> chunkShift)->unitSlots[(i + start) & chunkMask]; }
+
+    /** Returns the trial index of the i-th spike */
+    int getTrialIndex(int i) const { return chunks.getUnchecked((i + start) >> chunkShift)->trialIndices[(i + start) & chunkMask]; }
+
+    /** Returns the index of the first spike in a trial at or after trialIndex */
+    int findFirstOfTrial(int trialIndex) const;
+
+private:
+
+    static const int chunkShift = 10;
+    static const int chunkSize = 1 << chunkShift;
+    static const int chunkMask = chunkSize - 1;
+
+    struct Chunk
+    {
+        int32 sampleOffsets[chunkSize];
+        int32 trialIndices[chunkSize];
+        uint16 unitSlots[chunkSize];
+    };
+
+    OwnedArray<Chunk> chunks;
+
+    /** Position of the first stored spike within the first chunk */
+    int start = 0;
+
+    int numEntries = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(TrialStore);
+};
+
+
+#endif  // TRIALSTORE_H_
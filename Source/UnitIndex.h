@@ -0,0 +1,86 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2022 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef UNITINDEX_H_
+#define UNITINDEX_H_
+
+#include <ProcessorHeaders.h>
+
+#include <vector>
+
+/**
+
+    Maps the sorted IDs seen on one spike channel to dense unit slots.
+
+    Shared by all accumulators of a channel, so each unit is resolved
+    once per spike with a single table lookup. Slot 0 is always
+    sorted ID 0 (unsorted spikes).
+
+*/
+class UnitIndex
+{
+public:
+
+    /** Constructor */
+    UnitIndex();
+
+    /** Destructor */
+    ~UnitIndex() { }
+
+    /** Returns the slot for a sorted ID, adding it if it has not been seen */
+    int getSlot(int sortedId)
+    {
+        if (sortedId >= 0 && sortedId < (int) slots.size() && slots[sortedId] >= 0)
+            return slots[sortedId];
+
+        return addUnit(sortedId);
+    }
+
+    /** Returns the slot for a sorted ID, or -1 if it has not been seen */
+    int findSlot(int sortedId) const
+    {
+        if (sortedId >= 0 && sortedId < (int) slots.size())
+            return slots[sortedId];
+
+        return -1;
+    }
+
+    /** Returns all sorted IDs, in slot order */
+    const Array<int>& getSortedIds() const { return sortedIds; }
+
+    /** Returns the number of units seen so far */
+    int getNumUnits() const { return sortedIds.size(); }
+
+private:
+
+    /** Adds a new unit and returns its slot */
+    int addUnit(int sortedId);
+
+    std::vector<int> slots;
+    Array<int> sortedIds;
+
+    JUCE_DECLARE_NON_COPYABLE(UnitIndex);
+};
+
+
+#endif  // UNITINDEX_H_